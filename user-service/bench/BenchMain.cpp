@@ -0,0 +1,69 @@
+#include <iostream>
+#include <iomanip>
+#include <ctime>
+#include <nlohmann/json.hpp>
+#include "Benchmark.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+vector<pair<string, BenchSuiteFn>>& benchSuites(){
+    // function-local static: safe to use from static registrars in other translation units
+    static vector<pair<string, BenchSuiteFn>> sSuites;
+    return sSuites;
+}
+
+static void printJson(const vector<BenchmarkResult>& pResults){
+    json lBenchmarks = json::array();
+    for(const BenchmarkResult& lResult : pResults){
+        lBenchmarks.push_back({
+            {"name", lResult.name},
+            {"iterations", lResult.iterations},
+            {"ns_per_op", lResult.nsPerOp},
+            {"counters", lResult.counters}
+        });
+    }
+    json lReport = {
+        {"context", {
+            {"build_type", USER_SERVICE_BUILD_TYPE},
+            {"hardware_threads", thread::hardware_concurrency()},
+            {"timestamp", (int64_t)time(nullptr)}
+        }},
+        {"benchmarks", lBenchmarks}
+    };
+    cout<<lReport.dump(2)<<endl;
+}
+
+// ./user_service_bench [--json] [filter]
+//   filter: only run cases whose "suite/case" name contains this substring
+//   --json: print the results as one JSON document instead of a table
+int main(int argc, char* argv[]){
+    string lFilter;
+    bool lJson = false;
+    for(int i = 1; i < argc; ++i){
+        string lArg = argv[i];
+        if(lArg == "--json") lJson = true;
+        else lFilter = lArg;
+    }
+    BenchRunner lRunner(lFilter);
+
+    for(auto& [lName, lSuite] : benchSuites()){
+        lSuite(lRunner);
+    }
+
+    if(lJson){
+        printJson(lRunner.results());
+        return 0;
+    }
+
+    cout<<left<<setw(56)<<"benchmark"<<right<<setw(14)<<"ns/op"<<setw(14)<<"iterations"<<"  counters"<<endl;
+    for(const BenchmarkResult& lResult : lRunner.results()){
+        cout<<left<<setw(56)<<lResult.name<<right<<setw(14)<<fixed<<setprecision(1)<<lResult.nsPerOp
+            <<setw(14)<<lResult.iterations<<" ";
+        for(auto& [lKey, lValue] : lResult.counters){
+            cout<<" "<<lKey<<"="<<defaultfloat<<setprecision(6)<<lValue;
+        }
+        cout<<endl;
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Minimal benchmark harness for user_service_bench.
+// Every *Bench.cpp file registers one or more suites with BENCH_SUITE(name); a suite calls
+// pRunner.measure("case", [&]{ ...one operation... }) for each case it wants timed.
+// measure() auto-scales the iteration count until a case has run for at least ~200ms,
+// so cheap operations (ns) and expensive ones (Argon2, ~100ms) both get stable numbers.
+
+struct BenchmarkResult {
+    std::string name;
+    uint64_t iterations = 0;
+    double nsPerOp = 0;
+    std::map<std::string, double> counters; // extra per-case metrics, e.g. "bytes"
+};
+
+// Prevents the optimizer from deleting work whose result is never used
+template<typename T>
+inline void doNotOptimize(const T& pValue){
+    asm volatile("" : : "m"(pValue) : "memory");
+}
+
+class BenchRunner{
+    std::string mFilter;
+    std::vector<BenchmarkResult> mResults;
+
+    static constexpr double MIN_RUN_SECONDS = 0.2;
+
+    public:
+        explicit BenchRunner(std::string pFilter = "") : mFilter(std::move(pFilter)) {}
+
+        // true if "suite/case" matches the command line filter (substring match)
+        bool selected(const std::string& pName) const{
+            return mFilter.empty() || pName.find(mFilter) != std::string::npos;
+        }
+
+        template<typename Fn>
+        BenchmarkResult* measure(const std::string& pName, Fn&& pFn){
+            if(!selected(pName)) return nullptr;
+            using Clock = std::chrono::steady_clock;
+
+            pFn(); // warm-up: first call pays for lazy init, page faults, cold caches
+
+            uint64_t lIterations = 1;
+            double lElapsedSec = 0;
+            for(;;){
+                auto lStart = Clock::now();
+                for(uint64_t i = 0; i < lIterations; ++i) pFn();
+                lElapsedSec = std::chrono::duration<double>(Clock::now() - lStart).count();
+                if(lElapsedSec >= MIN_RUN_SECONDS || lIterations >= (1ull << 30)) break;
+                // aim straight for the target duration instead of only doubling
+                double lScale = (lElapsedSec > 0) ? (MIN_RUN_SECONDS * 1.2 / lElapsedSec) : 10.0;
+                if(lScale < 2) lScale = 2;
+                if(lScale > 100) lScale = 100;
+                lIterations = (uint64_t)(lIterations * lScale);
+            }
+
+            BenchmarkResult lResult;
+            lResult.name = pName;
+            lResult.iterations = lIterations;
+            lResult.nsPerOp = lElapsedSec * 1e9 / lIterations;
+            mResults.push_back(lResult);
+            return &mResults.back();
+        }
+
+        // Contention benchmark: pThreads threads each call pFn(threadIndex) pOpsPerThread times,
+        // all starting together. ns/op = wall time / total ops; "ops_per_sec" is the throughput.
+        template<typename Fn>
+        BenchmarkResult* measureThreads(const std::string& pName, int pThreads, uint64_t pOpsPerThread, Fn&& pFn){
+            if(!selected(pName)) return nullptr;
+            using Clock = std::chrono::steady_clock;
+
+            std::atomic<int> lReady{0};
+            std::atomic<bool> lGo{false};
+            std::vector<std::thread> lThreads;
+            for(int t = 0; t < pThreads; ++t){
+                lThreads.emplace_back([&, t]{
+                    lReady.fetch_add(1);
+                    while(!lGo.load(std::memory_order_acquire)) std::this_thread::yield();
+                    for(uint64_t i = 0; i < pOpsPerThread; ++i) pFn(t);
+                });
+            }
+            while(lReady.load() < pThreads) std::this_thread::yield();
+            auto lStart = Clock::now();
+            lGo.store(true, std::memory_order_release);
+            for(std::thread& lThread : lThreads) lThread.join();
+            double lElapsedSec = std::chrono::duration<double>(Clock::now() - lStart).count();
+
+            BenchmarkResult lResult;
+            lResult.name = pName;
+            lResult.iterations = pOpsPerThread * pThreads;
+            lResult.nsPerOp = lElapsedSec * 1e9 / lResult.iterations;
+            lResult.counters["threads"] = pThreads;
+            lResult.counters["ops_per_sec"] = lResult.iterations / lElapsedSec;
+            mResults.push_back(lResult);
+            return &mResults.back();
+        }
+
+        const std::vector<BenchmarkResult>& results() const { return mResults; }
+};
+
+// ---- suite registration ----
+using BenchSuiteFn = void (*)(BenchRunner&);
+
+std::vector<std::pair<std::string, BenchSuiteFn>>& benchSuites();
+
+struct BenchSuiteRegistrar{
+    BenchSuiteRegistrar(const char* pName, BenchSuiteFn pFn){
+        benchSuites().emplace_back(pName, pFn);
+    }
+};
+
+#define BENCH_SUITE(name)                                              \
+    static void name(BenchRunner& pRunner);                            \
+    static BenchSuiteRegistrar name##Registrar(#name, name);           \
+    static void name(BenchRunner& pRunner)
+
+#endif
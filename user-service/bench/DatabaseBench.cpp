@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <string>
+#include "Benchmark.h"
+#include "Database.h"
+
+using namespace std;
+
+// access to Database's private helpers (friend of Database)
+struct DatabaseBenchAccess{
+    static bool isValidEmail(Database& pDatabase, const string& pEmail){
+        return pDatabase.isValidEmail(pEmail);
+    }
+};
+
+static void removeDatabaseFiles(const string& pPath){
+    for(const char* lSuffix : {"", "-wal", "-shm"}){
+        remove((pPath + lSuffix).c_str());
+    }
+}
+
+// Statement costs with the real schema, once on a file (WAL, what the service runs with) and once
+// in memory (no I/O at all - the difference is what the disk/fsync costs).
+BENCH_SUITE(database){
+    const string lFilePath = "/tmp/user_service_bench.db";
+    struct Case { const char* name; string path; };
+
+    for(const Case& lCase : {Case{"file", lFilePath}, Case{"memory", ":memory:"}}){
+        string lPrefix = string("database/") + lCase.name + "/";
+        bool lAnySelected = false;
+        for(const char* lName : {"create_user", "get_user_by_id", "get_user_by_id_missing", "get_user_version"}){
+            lAnySelected = lAnySelected || pRunner.selected(lPrefix + lName);
+        }
+        if(!lAnySelected) continue; // skip the seeding too
+
+        removeDatabaseFiles(lFilePath);
+        Database lDatabase(lCase.path);
+
+        // seed rows for the reads, so they don't depend on which insert cases ran
+        const int lSeedRows = 1000;
+        for(int i = 0; i < lSeedRows; ++i){
+            lDatabase.createUser("seed" + to_string(i), "seed" + to_string(i) + "@example.com", "$argon2id$v=19$m=65536,t=2,p=1$stub");
+        }
+
+        uint64_t lInserted = 0;
+        pRunner.measure(lPrefix + "create_user", [&]{
+            string lId = to_string(lInserted++);
+            doNotOptimize(lDatabase.createUser("bench" + lId, "bench" + lId + "@example.com", "$argon2id$v=19$m=65536,t=2,p=1$stub"));
+        });
+
+        int lNextId = 0;
+        pRunner.measure(lPrefix + "get_user_by_id", [&]{
+            doNotOptimize(lDatabase.getUserById(1 + (lNextId++ % lSeedRows)));
+        });
+        pRunner.measure(lPrefix + "get_user_by_id_missing", [&]{
+            doNotOptimize(lDatabase.getUserById(-1));
+        });
+        pRunner.measure(lPrefix + "get_user_version", [&]{
+            doNotOptimize(lDatabase.getUserVersion(1 + (lNextId++ % lSeedRows)));
+        });
+    }
+    removeDatabaseFiles(lFilePath);
+
+    // the email regex, on its own (runs inside every createUser)
+    Database lDatabase(":memory:");
+    pRunner.measure("database/is_valid_email/valid", [&]{
+        doNotOptimize(DatabaseBenchAccess::isValidEmail(lDatabase, "jane.doe@example.com"));
+    });
+    pRunner.measure("database/is_valid_email/invalid", [&]{
+        doNotOptimize(DatabaseBenchAccess::isValidEmail(lDatabase, "jane.doe@example"));
+    });
+}
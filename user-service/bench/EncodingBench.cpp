@@ -0,0 +1,49 @@
+#include <nlohmann/json.hpp>
+#include "Benchmark.h"
+#include "ContentCodec.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Compares the wire formats offered through content negotiation (Accept header).
+// "bytes" is the encoded size; ns/op is CPU per encode/decode of one document.
+BENCH_SUITE(encoding){
+    // the exact document GET /users/{id} returns
+    json lGetUserResponse = {
+        {"status", "SUCCESS"},
+        {"data", {
+            {"id", 123456},
+            {"username", "jane.doe"},
+            {"email", "jane.doe@example.com"},
+            {"created_at", "2025-01-31 12:34:56"}
+        }}
+    };
+    // POST /users request body
+    json lCreateUserRequest = {
+        {"username", "jane.doe"},
+        {"email", "jane.doe@example.com"},
+        {"password", "correct horse battery staple"}
+    };
+
+    struct Case { const char* name; const json* doc; };
+    for(Case lCase : {Case{"get_user_response", &lGetUserResponse}, Case{"create_user_request", &lCreateUserRequest}}){
+        const json& lDoc = *lCase.doc;
+        string lPrefix = string("encoding/") + lCase.name + "/";
+
+        // the service's current JSON output is pretty-printed (dump(4)) - compact shown for reference
+        if(auto* r = pRunner.measure(lPrefix + "encode_json_compact", [&]{ doNotOptimize(lDoc.dump()); })){
+            r->counters["bytes"] = lDoc.dump().size();
+        }
+        for(BodyEncoding lEncoding : {BodyEncoding::JSON, BodyEncoding::MSGPACK, BodyEncoding::CBOR}){
+            string lName = ContentCodec::name(lEncoding);
+            string lEncoded = ContentCodec::encode(lDoc, lEncoding);
+
+            if(auto* r = pRunner.measure(lPrefix + "encode_" + lName, [&]{ doNotOptimize(ContentCodec::encode(lDoc, lEncoding)); })){
+                r->counters["bytes"] = lEncoded.size();
+            }
+            if(auto* r = pRunner.measure(lPrefix + "decode_" + lName, [&]{ doNotOptimize(ContentCodec::decode(lEncoded, lEncoding)); })){
+                r->counters["bytes"] = lEncoded.size();
+            }
+        }
+    }
+}
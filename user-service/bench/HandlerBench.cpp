@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>   // getpid
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+#include "Database.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "UserService.h"
+
+using namespace std;
+using json = nlohmann::json;
+using Clock = chrono::steady_clock;
+
+// Handler benchmark: requests built as httplib::Request objects and run through
+// UserService::dispatch - routing, admission, the handler, metrics and access log, but no socket,
+// no HTTP parsing and no kernel. A regression here is in our code, not in the network.
+//
+//   ./user_service_handler_bench [--threads N] [--duration S] [--users N] [--json] [filter]
+//
+// Per scenario: throughput, wall and thread-CPU time per request, latency percentiles, and
+// allocations per request - counted by the operator new below, which only this binary has.
+// Allocation numbers are exact and deterministic; a jump there is the earliest sign of a
+// slowdown (an extra copy, a map that stopped being reused) long before it shows in ns.
+
+// ---- allocation counting ----
+// thread_local: no contention between the bench threads, and each thread sums up only its own
+// requests. Everything ends in malloc/free, so delete needs no bookkeeping.
+static thread_local uint64_t tAllocations = 0;
+static thread_local uint64_t tAllocatedBytes = 0;
+
+static void* countedAlloc(size_t pSize){
+    ++tAllocations;
+    tAllocatedBytes += pSize;
+    void* lPtr = malloc(pSize ? pSize : 1);
+    if(!lPtr) throw bad_alloc();
+    return lPtr;
+}
+
+static void* countedAlignedAlloc(size_t pSize, align_val_t pAlign){
+    ++tAllocations;
+    tAllocatedBytes += pSize;
+    size_t lAlign = max((size_t)pAlign, sizeof(void*));
+    void* lPtr = nullptr;
+    if(posix_memalign(&lPtr, lAlign, pSize ? pSize : 1) != 0) throw bad_alloc();
+    return lPtr;
+}
+
+void* operator new(size_t pSize){ return countedAlloc(pSize); }
+void* operator new[](size_t pSize){ return countedAlloc(pSize); }
+void* operator new(size_t pSize, const nothrow_t&) noexcept{
+    try{ return countedAlloc(pSize); } catch(...){ return nullptr; }
+}
+void* operator new[](size_t pSize, const nothrow_t&) noexcept{
+    try{ return countedAlloc(pSize); } catch(...){ return nullptr; }
+}
+void* operator new(size_t pSize, align_val_t pAlign){ return countedAlignedAlloc(pSize, pAlign); }
+void* operator new[](size_t pSize, align_val_t pAlign){ return countedAlignedAlloc(pSize, pAlign); }
+void operator delete(void* pPtr) noexcept{ free(pPtr); }
+void operator delete[](void* pPtr) noexcept{ free(pPtr); }
+void operator delete(void* pPtr, size_t) noexcept{ free(pPtr); }
+void operator delete[](void* pPtr, size_t) noexcept{ free(pPtr); }
+void operator delete(void* pPtr, align_val_t) noexcept{ free(pPtr); }
+void operator delete[](void* pPtr, align_val_t) noexcept{ free(pPtr); }
+void operator delete(void* pPtr, size_t, align_val_t) noexcept{ free(pPtr); }
+void operator delete[](void* pPtr, size_t, align_val_t) noexcept{ free(pPtr); }
+
+static double threadCpuSeconds(){
+    timespec lTime;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &lTime);
+    return lTime.tv_sec + lTime.tv_nsec / 1e9;
+}
+
+// ---- scenarios ----
+struct Options {
+    int threads = (int)max(1u, thread::hardware_concurrency());
+    double durationSec = 2;     // per scenario
+    int users = 1000;           // seeded rows for the reads
+    bool json = false;
+    string filter;
+};
+
+struct Scenario {
+    const char* name;
+    int expectedStatus;
+    // fills in one request; pSequence is unique across threads
+    void (*build)(httplib::Request& pReq, uint64_t pSequence, const Options& pOptions);
+};
+
+static string sRunTag = to_string(getpid()) + "_" + to_string(time(nullptr));
+
+static void buildGet(httplib::Request& pReq, uint64_t pSequence, const Options& pOptions){
+    pReq.method = "GET";
+    pReq.target = "/users/" + to_string(1 + pSequence % pOptions.users);
+}
+
+static const Scenario sScenarios[] = {
+    {"health", 200, [](httplib::Request& pReq, uint64_t, const Options&){
+        pReq.method = "GET";
+        pReq.target = "/health";
+    }},
+    {"get_user", 200, buildGet},
+    {"get_user_msgpack", 200, [](httplib::Request& pReq, uint64_t pSequence, const Options& pOptions){
+        buildGet(pReq, pSequence, pOptions);
+        pReq.set_header("Accept", "application/msgpack");
+    }},
+    {"get_user_not_modified", 304, [](httplib::Request& pReq, uint64_t pSequence, const Options& pOptions){
+        buildGet(pReq, pSequence, pOptions);
+        pReq.set_header("If-None-Match", "\"" + to_string(1 + pSequence % pOptions.users) + "-1-JSON\"");
+    }},
+    {"get_user_missing", 404, [](httplib::Request& pReq, uint64_t pSequence, const Options& pOptions){
+        pReq.method = "GET";
+        pReq.target = "/users/" + to_string(pOptions.users + 1000000 + pSequence % 1000);
+    }},
+    {"find_by_email", 200, [](httplib::Request& pReq, uint64_t pSequence, const Options& pOptions){
+        pReq.method = "GET";
+        pReq.target = "/users?email=seed" + to_string(pSequence % pOptions.users) + "%40example.com";
+    }},
+    {"find_by_username_prefix", 200, [](httplib::Request& pReq, uint64_t pSequence, const Options& pOptions){
+        pReq.method = "GET";
+        pReq.target = "/users?username_prefix=SEED" + to_string(1 + pSequence % 9) + "&limit=20";
+    }},
+    {"suggest_username", 200, [](httplib::Request& pReq, uint64_t pSequence, const Options&){
+        pReq.method = "GET";
+        pReq.target = "/users/suggest?q=seed" + to_string(1 + pSequence % 9) + "&limit=10";
+    }},
+    {"search_substring", 200, [](httplib::Request& pReq, uint64_t pSequence, const Options&){
+        pReq.method = "GET";
+        pReq.target = "/users/search?q=ed" + to_string(10 + pSequence % 90) + "&limit=20";
+    }},
+    {"create_user_invalid", 400, [](httplib::Request& pReq, uint64_t, const Options&){
+        pReq.method = "POST";
+        pReq.target = "/users";
+        pReq.set_header("Content-Type", "application/json");
+        pReq.body = R"({"username":"bench"})";
+    }},
+    // Argon2 dominates (~100ms, 64 MiB) - the interesting part is everything around it
+    {"create_user", 201, [](httplib::Request& pReq, uint64_t pSequence, const Options&){
+        string lName = "hb_" + sRunTag + "_" + to_string(pSequence);
+        pReq.method = "POST";
+        pReq.target = "/users";
+        pReq.set_header("Content-Type", "application/json");
+        pReq.body = json{{"username", lName}, {"email", lName + "@example.com"}, {"password", "Bench!" + lName}}.dump();
+    }},
+};
+
+struct ScenarioResult {
+    uint64_t requests = 0;
+    uint64_t unexpected = 0;    // status other than the scenario's expected one
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+    double cpuSeconds = 0;      // sum over the bench threads
+    double wallSeconds = 0;
+    LatencyHistogram latency;
+};
+
+static void runScenario(UserService& pService, const Scenario& pScenario, const Options& pOptions, ScenarioResult& pResult){
+    atomic<uint64_t> lSequence{0};
+    atomic<uint64_t> lRequests{0}, lUnexpected{0}, lAllocations{0}, lBytes{0};
+    atomic<int64_t> lCpuNanos{0};
+    atomic<bool> lGo{false};
+    Clock::time_point lEnd;
+
+    vector<thread> lThreads;
+    for(int t = 0; t < pOptions.threads; ++t){
+        lThreads.emplace_back([&]{
+            while(!lGo.load(memory_order_acquire)) this_thread::yield();
+            uint64_t lMyRequests = 0, lMyUnexpected = 0, lMyAllocations = 0, lMyBytes = 0;
+            double lCpuStart = threadCpuSeconds();
+            while(Clock::now() < lEnd){
+                httplib::Request lReq;
+                pScenario.build(lReq, lSequence.fetch_add(1, memory_order_relaxed), pOptions);
+                httplib::Response lRes;
+
+                // only dispatch is counted - building the request is the harness's cost
+                uint64_t lAllocBefore = tAllocations, lBytesBefore = tAllocatedBytes;
+                Clock::time_point lStart = Clock::now();
+                pService.dispatch(lReq, lRes);
+                pResult.latency.recordDuration(Clock::now() - lStart);
+                lMyAllocations += tAllocations - lAllocBefore;
+                lMyBytes += tAllocatedBytes - lBytesBefore;
+
+                ++lMyRequests;
+                if(lRes.status != pScenario.expectedStatus) ++lMyUnexpected;
+            }
+            lCpuNanos.fetch_add((int64_t)((threadCpuSeconds() - lCpuStart) * 1e9));
+            lRequests += lMyRequests;
+            lUnexpected += lMyUnexpected;
+            lAllocations += lMyAllocations;
+            lBytes += lMyBytes;
+        });
+    }
+
+    Clock::time_point lStart = Clock::now();
+    lEnd = lStart + chrono::duration_cast<Clock::duration>(chrono::duration<double>(pOptions.durationSec));
+    lGo.store(true, memory_order_release);
+    for(thread& lThread : lThreads) lThread.join();
+
+    pResult.wallSeconds = chrono::duration<double>(Clock::now() - lStart).count();
+    pResult.requests = lRequests;
+    pResult.unexpected = lUnexpected;
+    pResult.allocations = lAllocations;
+    pResult.allocatedBytes = lBytes;
+    pResult.cpuSeconds = lCpuNanos / 1e9;
+}
+
+static Options parseOptions(int argc, char* argv[]){
+    Options lOptions;
+    for(int i = 1; i < argc; ++i){
+        string lArg = argv[i];
+        if(lArg == "--json"){ lOptions.json = true; continue; }
+        if(lArg.rfind("--", 0) != 0){ lOptions.filter = lArg; continue; }
+        if(i + 1 >= argc) throw invalid_argument("Missing value for option " + lArg);
+        string lValue = argv[++i];
+        if(lArg == "--threads") lOptions.threads = max(1, stoi(lValue));
+        else if(lArg == "--duration") lOptions.durationSec = stod(lValue);
+        else if(lArg == "--users") lOptions.users = max(1, stoi(lValue));
+        else throw invalid_argument("Unknown option " + lArg);
+    }
+    return lOptions;
+}
+
+int main(int argc, char* argv[]){
+    try{
+        Options lOptions = parseOptions(argc, argv);
+        string lDbPath = "/tmp/user_service_handler_bench_" + to_string(getpid()) + ".db";
+        string lLogPath = "/tmp/user_service_handler_bench_" + to_string(getpid()) + ".log";
+
+        // seed rows straight into the table - one real hash, reused (Argon2 per row would take minutes)
+        {
+            Database lDatabase(lDbPath);
+            string lPassword = "Seed!password";
+            string lHash = PasswordService().hashPassword(lPassword);
+            for(int i = 0; i < lOptions.users; ++i){
+                string lName = "seed" + to_string(i);
+                lDatabase.createUser(lName, lName + "@example.com", lHash);
+            }
+        }
+
+        FileLogger::getInstance(lLogPath)->setLogLevel(LOG_LEVEL::ERROR); // the server's default
+        unique_ptr<UserService> lService = make_unique<UserService>(lDbPath, lLogPath);
+        lService->setConcurrencyLimit("POST /users", 0); // measure the handler, not admission control
+
+        json lResults = json::array();
+        if(!lOptions.json){
+            cout<<left<<setw(24)<<"scenario"<<right<<setw(10)<<"requests"<<setw(12)<<"req/s"<<setw(12)<<"wall us"
+                <<setw(12)<<"cpu us"<<setw(10)<<"allocs"<<setw(11)<<"bytes"<<setw(11)<<"p50 us"<<setw(11)<<"p99 us"<<setw(8)<<"bad"<<endl;
+        }
+        for(const Scenario& lScenario : sScenarios){
+            if(!lOptions.filter.empty() && string(lScenario.name).find(lOptions.filter) == string::npos) continue;
+
+            ScenarioResult lResult;
+            runScenario(*lService, lScenario, lOptions, lResult);
+            double lPerRequest = lResult.requests ? 1.0 / lResult.requests : 0;
+            LatencyHistogram::Snapshot lLatency = lResult.latency.snapshot();
+
+            if(lOptions.json){
+                lResults.push_back({
+                    {"name", string("handler/") + lScenario.name},
+                    {"requests", lResult.requests},
+                    {"unexpected_status", lResult.unexpected},
+                    {"requests_per_sec", lResult.requests / lResult.wallSeconds},
+                    {"wall_us_per_request", lResult.wallSeconds * lOptions.threads * 1e6 * lPerRequest},
+                    {"cpu_us_per_request", lResult.cpuSeconds * 1e6 * lPerRequest},
+                    {"allocs_per_request", lResult.allocations * lPerRequest},
+                    {"bytes_per_request", lResult.allocatedBytes * lPerRequest},
+                    {"p50_us", lLatency.quantileMicros(0.5)},
+                    {"p99_us", lLatency.quantileMicros(0.99)}
+                });
+                continue;
+            }
+            cout<<left<<setw(24)<<lScenario.name<<right<<setw(10)<<lResult.requests<<fixed<<setprecision(1)
+                <<setw(12)<<lResult.requests / lResult.wallSeconds
+                <<setw(12)<<lResult.wallSeconds * lOptions.threads * 1e6 * lPerRequest
+                <<setw(12)<<lResult.cpuSeconds * 1e6 * lPerRequest
+                <<setw(10)<<lResult.allocations * lPerRequest<<setw(11)<<setprecision(0)<<lResult.allocatedBytes * lPerRequest
+                <<setprecision(1)<<setw(11)<<lLatency.quantileMicros(0.5)<<setw(11)<<lLatency.quantileMicros(0.99)
+                <<setw(8)<<lResult.unexpected<<endl;
+        }
+
+        if(lOptions.json){
+            json lReport = {
+                {"context", {
+                    {"build_type", USER_SERVICE_BUILD_TYPE},
+                    {"threads", lOptions.threads},
+                    {"hardware_threads", thread::hardware_concurrency()},
+                    {"timestamp", (int64_t)time(nullptr)}
+                }},
+                {"benchmarks", lResults}
+            };
+            cout<<lReport.dump(2)<<endl;
+        }
+        else{
+            cout<<"(wall/cpu us = per request per thread; allocs/bytes = operator new calls inside dispatch; bad = unexpected status)"<<endl;
+        }
+
+        lService.reset();
+        for(const char* lSuffix : {"", "-wal", "-shm"}) remove((lDbPath + lSuffix).c_str());
+        remove(lLogPath.c_str());
+    }
+    catch(const exception& e){
+        cerr<<"user_service_handler_bench: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}
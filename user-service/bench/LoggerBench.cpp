@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <string>
+#include "Benchmark.h"
+#include "Logger.h"
+
+using namespace std;
+
+// FileLogger::log throughput with 1..8 threads logging an access-log sized line concurrently,
+// sync path (mutex + one write() per line) vs async path (lock-free ring + batching writer).
+// The async cases measure what the request thread pays (format + push); the writer thread
+// drains the ring concurrently and disableAsync() flushes whatever is left afterwards.
+BENCH_SUITE(logger){
+    string lLogPath = "/tmp/user_service_bench_logger.txt";
+    shared_ptr<FileLogger> lLogger = FileLogger::getInstance(lLogPath);
+    lLogger->setLogLevel(LOG_LEVEL::INFO);
+    const string lMessage = "GET /users/123456 - 200 - 0.182ms";
+    const uint64_t lOpsPerThread = 20000;
+
+    for(int lThreads : {1, 4, 8}){
+        string lSuffix = "/threads:" + to_string(lThreads);
+
+        lLogger->disableAsync();
+        pRunner.measureThreads("logger/sync" + lSuffix, lThreads, lOpsPerThread, [&](int){
+            lLogger->log(lMessage, LOG_LEVEL::INFO);
+        });
+
+        // BLOCK: every record is written, so the numbers compare like with like
+        lLogger->enableAsync(1 << 16, LogOverflowPolicy::BLOCK);
+        pRunner.measureThreads("logger/async_block" + lSuffix, lThreads, lOpsPerThread, [&](int){
+            lLogger->log(lMessage, LOG_LEVEL::INFO);
+        });
+        lLogger->disableAsync();
+
+        lLogger->enableAsync(1 << 16, LogOverflowPolicy::DROP); // same ring - it is allocated once
+        uint64_t lDroppedBefore = lLogger->droppedRecords();
+        if(auto* r = pRunner.measureThreads("logger/async_drop" + lSuffix, lThreads, lOpsPerThread, [&](int){
+            lLogger->log(lMessage, LOG_LEVEL::INFO);
+        })){
+            r->counters["dropped"] = (double)(lLogger->droppedRecords() - lDroppedBefore);
+        }
+        lLogger->disableAsync();
+    }
+
+    // Cost of a log call whose level is off: eager (build the string, then log() drops it)
+    // vs the LOG_* macro (one atomic load, arguments never evaluated)
+    lLogger->setLogLevel(LOG_LEVEL::WARNING);
+    string lMethod = "GET", lPath = "/users/123456";
+    int lStatus = 200;
+    double lMillis = 0.182;
+    pRunner.measure("logger/disabled/eager", [&]{
+        lLogger->log(lMethod + " " + lPath + " - " + to_string(lStatus), LOG_LEVEL::INFO);
+    });
+    pRunner.measure("logger/disabled/macro", [&]{
+        LOG_INFO(lLogger, "{} {} - {} - {}ms", lMethod, lPath, lStatus, lMillis);
+    });
+    lLogger->setLogLevel(LOG_LEVEL::INFO);
+    pRunner.measure("logger/format/macro", [&]{
+        // formatted into the thread_local buffer, then written (sync path)
+        LOG_INFO(lLogger, "{} {} - {} - {}ms", lMethod, lPath, lStatus, lMillis);
+    });
+    // binary mode is one way - keep this case last
+    lLogger->enableBinary();
+    pRunner.measure("logger/binary/macro", [&]{
+        LOG_INFO(lLogger, "{} {} - {} - {}ms", lMethod, lPath, lStatus, lMillis);
+    });
+    remove(lLogPath.c_str());
+}
@@ -0,0 +1,23 @@
+#include <string>
+#include "Benchmark.h"
+#include "PasswordService.h"
+
+using namespace std;
+
+// Argon2id with the service's parameters (t=2, m=64 MiB, p=1) - the dominant cost of a signup,
+// and of a login once there is one. Expect ~tens of ms per op: few iterations, that's fine.
+BENCH_SUITE(password){
+    PasswordService lPasswordService;
+    string lPassword = "correct horse battery staple";
+    string lHash = lPasswordService.hashPassword(lPassword);
+
+    pRunner.measure("password/hash", [&]{
+        doNotOptimize(lPasswordService.hashPassword(lPassword));
+    });
+    pRunner.measure("password/verify_match", [&]{
+        doNotOptimize(lPasswordService.verifyPassword(lPassword, lHash));
+    });
+    pRunner.measure("password/verify_mismatch", [&]{
+        doNotOptimize(lPasswordService.verifyPassword("wrong password", lHash));
+    });
+}
@@ -0,0 +1,33 @@
+#include "Benchmark.h"
+#include "RequestContext.h"
+
+using namespace std;
+
+// Overhead of the Server-Timing instrumentation for one request shaped like POST /users
+// (parse, argon2, db-insert, encode). "disabled" is the cost left in the code paths when no
+// request context is active; "enabled" adds begin/end and building the header string.
+BENCH_SUITE(request_context){
+    auto lPhases = []{
+        { PhaseTimer lTimer("parse"); }
+        { PhaseTimer lTimer("argon2"); }
+        { PhaseTimer lTimer("db-insert"); }
+        { PhaseTimer lTimer("encode"); }
+    };
+
+    pRunner.measure("request_context/4_phases_disabled", [&]{
+        lPhases();
+    });
+
+    pRunner.measure("request_context/4_phases_enabled", [&]{
+        RequestContext::begin();
+        lPhases();
+        RequestContext::end();
+    });
+
+    pRunner.measure("request_context/4_phases_enabled_with_header", [&]{
+        RequestContext::begin();
+        lPhases();
+        doNotOptimize(RequestContext::current()->serverTimingHeader());
+        RequestContext::end();
+    });
+}
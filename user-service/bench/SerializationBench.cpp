@@ -0,0 +1,32 @@
+#include <nlohmann/json.hpp>
+#include "Benchmark.h"
+#include "UserService.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// User -> JSON -> text, the tail end of GET /users/{id}
+BENCH_SUITE(serialization){
+    User lUser;
+    lUser.id = 123456;
+    lUser.username = "jane.doe";
+    lUser.email = "jane.doe@example.com";
+    lUser.created_at_ms = 1738326896000; // 2025-01-31 12:34:56 UTC
+
+    pRunner.measure("serialization/to_json", [&]{
+        json lJson = lUser;
+        doNotOptimize(lJson);
+    });
+    json lResponse = {{"status", "SUCCESS"}, {"data", lUser}};
+    // dump(4): what the service sends for JSON
+    if(auto* r = pRunner.measure("serialization/dump_pretty", [&]{ doNotOptimize(lResponse.dump(4)); })){
+        r->counters["bytes"] = lResponse.dump(4).size();
+    }
+    if(auto* r = pRunner.measure("serialization/dump_compact", [&]{ doNotOptimize(lResponse.dump()); })){
+        r->counters["bytes"] = lResponse.dump().size();
+    }
+    pRunner.measure("serialization/to_json_and_dump", [&]{
+        json lBody = {{"status", "SUCCESS"}, {"data", lUser}};
+        doNotOptimize(lBody.dump(4));
+    });
+}
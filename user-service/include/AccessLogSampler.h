@@ -0,0 +1,40 @@
+#ifndef ACCESS_LOG_SAMPLER_H
+#define ACCESS_LOG_SAMPLER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Decides whether one access log line of a (route, status class) gets written.
+// Two kinds of rules:
+//   "1/N"  - every N-th request is logged (deterministic, easy to scale back up: count * N)
+//   "R/s"  - token bucket, at most R lines per second with bursts of up to R lines
+// Both are lock-free: one atomic increment, or one CAS loop on a timestamp (GCRA - the
+// token bucket expressed as a "theoretical arrival time", so there is no refill thread and no
+// separate token count to keep consistent with the clock).
+class AccessLogSampler{
+    public:
+        // throws invalid_argument on anything that isn't "1/N" or "R/s"
+        static std::shared_ptr<AccessLogSampler> parse(const std::string& pRule);
+
+        bool shouldLog();
+
+        const std::string& rule() const { return mRule; }
+
+    private:
+        AccessLogSampler() = default;
+
+        std::string mRule;
+
+        // 1-in-N
+        uint64_t mEvery = 0;
+        std::atomic<uint64_t> mSeen{0};
+
+        // token bucket (GCRA), steady_clock nanoseconds
+        int64_t mEmissionIntervalNs = 0;   // 1s / R
+        int64_t mBurstToleranceNs = 0;     // how far the arrival time may run ahead of now
+        std::atomic<int64_t> mTheoreticalArrivalNs{0};
+};
+
+#endif
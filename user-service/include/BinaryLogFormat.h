@@ -0,0 +1,128 @@
+#ifndef BINARY_LOG_FORMAT_H
+#define BINARY_LOG_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Binary log format (NanoLog style) - "--log-format binary".
+//
+// A LOG_* call site has a constant format string. It is registered ONCE (function-local static in
+// the macro) and gets a small integer id; after that every log call only writes the id, a raw
+// timestamp and the raw argument bytes - no "{}" substitution, no number -> text conversion,
+// no date formatting. The text is rebuilt offline by user_service_logdecode.
+//
+// File layout (native byte order, the decoder runs on the same kind of machine):
+//   [optional text preamble, e.g. "Logging started.\n"]
+//   "USLOGBIN" u32 version
+//   records, each starting with a one byte tag:
+//     'D' u32 formatId, u8 level, u32 length, format bytes        - format definition
+//     'L' u32 formatId, i64 unixMicros, u8 argCount, args...       - log call, args below
+//     'T' u8 level, i64 unixMicros, u32 length, text bytes         - plain log(string) call
+//   args: 'i' i64 | 'u' u64 | 'd' f64 | 's' u32 length, bytes
+// A definition always precedes the first record that uses its id.
+namespace binlog {
+    constexpr char MAGIC[8] = {'U', 'S', 'L', 'O', 'G', 'B', 'I', 'N'};
+    constexpr uint32_t VERSION = 1;
+
+    constexpr char RECORD_DEFINITION = 'D';
+    constexpr char RECORD_LOG = 'L';
+    constexpr char RECORD_TEXT = 'T';
+
+    constexpr char ARG_INT = 'i';
+    constexpr char ARG_UINT = 'u';
+    constexpr char ARG_DOUBLE = 'd';
+    constexpr char ARG_STRING = 's';
+
+    template<typename T>
+    inline void appendRaw(std::string& pOut, T pValue){
+        pOut.append(reinterpret_cast<const char*>(&pValue), sizeof(T));
+    }
+
+    inline void appendString(std::string& pOut, const char* pData, size_t pLength){
+        pOut += ARG_STRING;
+        appendRaw<uint32_t>(pOut, (uint32_t)pLength);
+        pOut.append(pData, pLength);
+    }
+
+    // one overload per argument type accepted by the text formatter (appendLogArg)
+    inline void appendArg(std::string& pOut, const std::string& pValue) { appendString(pOut, pValue.data(), pValue.size()); }
+    inline void appendArg(std::string& pOut, std::string_view pValue) { appendString(pOut, pValue.data(), pValue.size()); }
+    inline void appendArg(std::string& pOut, const char* pValue){
+        if(!pValue) pValue = "(null)";
+        appendString(pOut, pValue, strlen(pValue));
+    }
+    inline void appendArg(std::string& pOut, char pValue) { appendString(pOut, &pValue, 1); }
+    inline void appendArg(std::string& pOut, double pValue) { pOut += ARG_DOUBLE; appendRaw<double>(pOut, pValue); }
+    template<typename T>
+    inline std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>
+    appendArg(std::string& pOut, T pValue){
+        if constexpr(std::is_signed_v<T>){
+            pOut += ARG_INT;
+            appendRaw<int64_t>(pOut, (int64_t)pValue);
+        }
+        else{
+            pOut += ARG_UINT;
+            appendRaw<uint64_t>(pOut, (uint64_t)pValue);
+        }
+    }
+
+    template<typename... Args>
+    void appendLogRecord(std::string& pOut, uint32_t pFormatId, int64_t pUnixMicros, const Args&... pArgs){
+        static_assert(sizeof...(Args) < 256, "too many log arguments");
+        pOut += RECORD_LOG;
+        appendRaw<uint32_t>(pOut, pFormatId);
+        appendRaw<int64_t>(pOut, pUnixMicros);
+        appendRaw<uint8_t>(pOut, (uint8_t)sizeof...(Args));
+        (appendArg(pOut, pArgs), ...);
+    }
+
+    void appendTextRecord(std::string& pOut, int pLevel, int64_t pUnixMicros, const std::string& pText);
+    void appendHeader(std::string& pOut);
+}
+
+// Process-wide table of registered format strings: id -> (format, level)
+class LogFormatRegistry{
+    public:
+        using DefinitionSink = std::function<void(const std::string& pRecord)>;
+
+        static LogFormatRegistry& getInstance();
+
+        // Called once per call site. pFormat must outlive the process (a string literal).
+        uint32_t registerFormat(const char* pFormat, int pLevel);
+
+        // The sink receives the definition record of every format registered so far, and then
+        // of each new one as it is registered - that's how a binary log file gets its dictionary.
+        void attachSink(DefinitionSink pSink);
+        void detachSink();
+
+        // header + every definition so far - the start of a new (rotated) binary segment.
+        // Lock-free: it runs on the write path (under the logger's file mutex, or on its writer
+        // thread), while registerFormat() holds mMtx and waits for that same path in its sink.
+        void appendPreamble(std::string& pOut);
+
+    private:
+        LogFormatRegistry() = default;
+
+        struct Entry {
+            const char* format;
+            int level;
+        };
+        static void appendDefinition(std::string& pOut, uint32_t pFormatId, const Entry& pEntry);
+
+        using Formats = std::vector<Entry>;
+
+        std::mutex mMtx; // serializes registrations and the sink (not appendPreamble)
+        // index + 1 = format id (0 = "not registered"). Copy-on-write: a registration publishes
+        // a new vector (std::atomic_store), readers take a snapshot with std::atomic_load.
+        std::shared_ptr<const Formats> mFormats = std::make_shared<const Formats>();
+        DefinitionSink mSink;
+};
+
+#endif
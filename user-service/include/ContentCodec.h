@@ -0,0 +1,42 @@
+#ifndef CONTENT_CODEC_H
+#define CONTENT_CODEC_H
+
+#include <string>
+#include <string_view>
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+// Wire formats the service can speak. JSON stays the default (and the format for browsers/curl);
+// MessagePack and CBOR are compact binary encodings of the same document, meant for
+// service-to-service calls where nobody reads the payload.
+enum class BodyEncoding {
+    JSON,
+    MSGPACK,
+    CBOR
+};
+
+// Content negotiation + (de)serialization of nlohmann::json documents
+class ContentCodec{
+    public:
+        // Picks the response encoding from the "Accept" header (highest q-value that we support).
+        // Falls back to JSON when the header is missing or lists nothing we know; entries with
+        // q=0 are "not acceptable" and never chosen.
+        static BodyEncoding negotiate(const httplib::Request& pReq);
+
+        // Encoding of the request body, taken from the "Content-Type" header (default JSON)
+        static BodyEncoding requestEncoding(const httplib::Request& pReq);
+
+        static std::string encode(const nlohmann::json& pJson, BodyEncoding pEncoding);
+
+        // throws nlohmann::json::parse_error if the body is not valid in the given encoding
+        static nlohmann::json decode(const std::string& pBody, BodyEncoding pEncoding);
+
+        static const char* contentType(BodyEncoding pEncoding);
+        static const char* name(BodyEncoding pEncoding);
+
+    private:
+        // maps a media type ("application/msgpack") to an encoding, returns false if unsupported
+        static bool fromMediaType(std::string_view pMediaType, BodyEncoding& pEncoding);
+};
+
+#endif
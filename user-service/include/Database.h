@@ -4,10 +4,19 @@
 #ifndef DATABASE_H  // Conditional block start: "If NOT defined DATABASE_H"
 #define DATABASE_H  // Define DATABASE_H
 
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <sqlite3.h>
 #include <optional> // C++17 feature - 
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Logger.h"
 
 // if a header file includes a using namespace directive or a using declaration at the global
 // scope, that effect will be propagated to any .cpp file(or other header file) that includes it.
@@ -21,12 +30,51 @@ struct User {
     std::string username;
     std::string email;
     // string password; // we don't want to load sensitive data into memory when it's not needed.
-    std::string created_at;
+    int64_t created_at_ms = 0; // milliseconds since the epoch (UTC) - formatted for clients by to_json
+    int64_t version = 1; // row version, bumped on every update - used for ETags
+};
+
+// Keyset pagination position for username searches: the last (username, id) of the previous page
+struct UsernameCursor {
+    std::string username;
+    int id = 0;
+};
+
+// Same for creation time ranges: the last (created_at_ms, id) of the previous page
+struct CreatedAtCursor {
+    int64_t createdAtMs = 0;
+    int id = 0;
+};
+
+// All users as of one moment, for streaming exports (GET /admin/export). Reads on a read-only
+// connection of its own inside one read transaction: WAL gives it a fixed snapshot of the file
+// for as long as it is open, while the service keeps reading and writing through the main
+// connection. Rows come one at a time from the primary key b-tree - memory stays constant
+// however big the table is. Note: while it is open, checkpoints can't go past its snapshot, so
+// the WAL file grows with the writes that happen meanwhile.
+// One thread at a time (it is a cursor).
+class UserSnapshot {
+    public:
+        explicit UserSnapshot(const std::string& pDBPath);
+        ~UserSnapshot();
+        UserSnapshot(const UserSnapshot&) = delete;
+        UserSnapshot& operator=(const UserSnapshot&) = delete;
+
+        // fills pUser with the next user in id order (reusing its strings), false at the end
+        bool next(User& pUser);
+        int64_t rowsRead() const { return mRowsRead; }
+
+    private:
+        sqlite3* mDB = nullptr;
+        sqlite3_stmt* mStmt = nullptr;
+        bool mDone = false;
+        int64_t mRowsRead = 0;
 };
 
 class Database {
     private:
         sqlite3* mDB;
+        std::shared_ptr<ILogger> mLogger; // optional - nullptr means "don't log"
 
         // Deleter Functor (structure/class with overloaded operator())
         struct StmtDeleter{
@@ -37,8 +85,52 @@ class Database {
             }
         };
 
+        // user id -> row version, lets conditional GETs (If-None-Match) skip the users query
+        std::unordered_map<int, int64_t> mVersionCache;
+        std::shared_mutex mVersionCacheMtx;   // many readers, rare writers
+        int64_t mCachedDataVersion = -1;      // PRAGMA data_version the cache is valid for
+        static constexpr size_t MAX_CACHED_VERSIONS = 100000;
+
+        std::unique_ptr<sqlite3_stmt, StmtDeleter> mDataVersionStmt;
+        std::mutex mDataVersionStmtMtx;
+
+        // Prepared statement pool. The connection is shared by all request threads, and a
+        // statement can only be stepped by one of them at a time - so every statement has a
+        // free list: acquireStatement() takes one (or prepares a new one), the returned handle
+        // resets it and puts it back. Saves the prepare (parse + plan, most of a point query's
+        // cost) on every call.
+        enum StatementId {
+            STMT_INSERT_USER,
+            STMT_SELECT_USER,
+            STMT_SELECT_VERSION,
+            STMT_SELECT_USER_BY_EMAIL,
+            STMT_SELECT_USERS_BY_USERNAME_PREFIX,
+            STMT_SEARCH_USERS,
+            STMT_SELECT_USERS_BY_CREATED_AT,
+            STMT_COUNT
+        };
+        static const char* const sStatementSql[STMT_COUNT];
+        struct StatementSlot {
+            std::mutex mtx;
+            std::vector<sqlite3_stmt*> idle;
+        };
+        StatementSlot mStatementPool[STMT_COUNT];
+
+        struct StmtReturner{
+            Database* db;
+            StatementId id;
+            void operator()(sqlite3_stmt* stmt) const;
+        };
+        using PooledStmt = std::unique_ptr<sqlite3_stmt, StmtReturner>;
+        PooledStmt acquireStatement(StatementId pId);
+
+        // Fills the search index for rows that predate it, see backfillSearchIndex()
+        std::thread mSearchBackfillThread;
+        std::atomic<bool> mStopSearchBackfill{false};
+        std::atomic<bool> mSearchIndexComplete{true};
+
     public:
-    Database(const std::string dbname = "user_db.db");
+    Database(const std::string dbname = "user_db.db", std::shared_ptr<ILogger> pLogger = nullptr);
 
     ~Database();
 
@@ -48,8 +140,13 @@ class Database {
     // char **azColName: An array of strings, where azColName[i] is the name of the i-th column.
     static int executeQueryCallback(void* data, int argc, char** argv, char** azcolNames);
 
-    /// method to create the users table with fields: id, username, email, password, created_at
-    void createTables();
+    // Latest schema version this build knows (PRAGMA user_version after migrateSchema)
+    static int schemaVersion();
+
+    // Optional warmup before serving traffic: prepares every statement, reads the tables and
+    // indexes once (OS page cache + as much as fits in SQLite's cache) and loads the row
+    // versions for conditional GETs. Returns the number of rows + index entries read.
+    int64_t prewarm();
 
     // function to create user
     int createUser(const std::string& pUsername, const std::string& pEmailId, const std::string& pPassword);
@@ -57,9 +154,73 @@ class Database {
     // function to get user
     std::optional<User> getUserById(int pUserId);
 
+    // function to get only the row version of a user (std::nullopt if the user does not exist)
+    std::optional<int64_t> getUserVersion(int pUserId);
+
+    // exact, case-sensitive email match (the UNIQUE index)
+    std::optional<User> getUserByEmail(const std::string& pEmailId);
+
+    // Up to pLimit users whose username starts with pPrefix, ASCII case-insensitive, ordered by
+    // (username NOCASE, id). Pass the last user of the previous page as pAfter for the next one.
+    std::vector<User> findUsersByUsernamePrefix(const std::string& pPrefix, int pLimit,
+                                                const std::optional<UsernameCursor>& pAfter = std::nullopt);
+
+    // Up to pLimit users created strictly between pAfterMs and pBeforeMs (epoch ms), oldest first
+    // (ties by id) - a range scan on the created_at_ms index. pAfter continues after a page.
+    std::vector<User> findUsersByCreatedAt(int64_t pAfterMs, int64_t pBeforeMs, int pLimit,
+                                           const std::optional<CreatedAtCursor>& pAfter = std::nullopt);
+
+    // Substring search over username and email (FTS5 trigram index, case-insensitive; pQuery
+    // needs at least 3 characters to match anything). Best matches first - username hits rank
+    // above email hits - then by id; pOffset skips that many matches.
+    std::vector<User> searchUsers(const std::string& pQuery, int pLimit, int pOffset);
+    // false while rows from before the search index existed are still being added to it
+    bool searchIndexComplete() const;
+
+    // Opens a consistent read-only snapshot of the users table, see UserSnapshot
+    std::unique_ptr<UserSnapshot> openSnapshot();
+
+    // Calls pFn(id, username) for every user with id > pAfterId, in id order, and returns the
+    // highest id seen (pAfterId if there were none) - for in-memory indexes that load the table
+    // once and then only catch up on new rows.
+    int forEachUsername(int pAfterId, const std::function<void(int, const std::string&)>& pFn);
+
+    // "PRAGMA data_version": changes whenever ANOTHER connection commits, our own writes don't
+    // change it. Cheap - no table pages are read.
+    int64_t readDataVersion();
+
     private:
+    /// method to enable WAL mode and busy timeout on the connection
+    void configureConnection();
+
+    /// method to bring the schema up to schemaVersion(), one migration at a time
+    void migrateSchema();
+    int64_t readUserVersion();
+    void execute(const std::string& pSql, const char* pWhat);
+
+    // One schema change; migrations() lists them in order
+    struct Migration {
+        int version;              // PRAGMA user_version once this step is applied
+        const char* description;
+        void (Database::*apply)();
+    };
+    static const std::vector<Migration>& migrations();
+    void createUsersTable();
+    void addVersionTracking();
+    void addUsernameIndex();
+    void addSearchIndex();
+    void addCreatedAtMs();
+    void backfillSearchIndex(std::string pDBPath);
+
+    // the columns of sStatementSql's user SELECTs: id, username, email, created_at_ms, version
+    static User readUser(sqlite3_stmt* pStmt);
+
+    void cacheUserVersion(int pUserId, int64_t pVersion);
+
     // function to validate email address format
     bool isValidEmail(const std::string& pEmailId);
+
+    friend struct DatabaseBenchAccess; // bench/DatabaseBench.cpp times the private helpers too
 };
 
 #endif   // End of the Conditional Block
\ No newline at end of file
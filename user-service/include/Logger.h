@@ -6,6 +6,18 @@
 #include <fstream> // for file handling
 #include <memory>  // shared_ptr
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <chrono>
+#include <charconv>    // to_chars
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include "MpscRing.h"
+#include "BinaryLogFormat.h"
+#include "Metrics.h"   // METRIC_SHARD_COUNT, metricShardIndex()
 
 enum LOG_LEVEL {
     ERROR,   // 0
@@ -14,27 +26,224 @@ enum LOG_LEVEL {
     DEBUG    // 3
 };
 
+// ---- lazy formatting helpers ----
+// "{}" placeholders are replaced by the arguments, in order: ("{} {} - {}", "GET", "/health", 200)
+// Only used once the level check has passed, and always into a reused thread_local buffer.
+inline void appendLogArg(std::string& pOut, const std::string& pValue) { pOut += pValue; }
+inline void appendLogArg(std::string& pOut, std::string_view pValue) { pOut.append(pValue.data(), pValue.size()); }
+inline void appendLogArg(std::string& pOut, const char* pValue) { pOut += (pValue ? pValue : "(null)"); }
+inline void appendLogArg(std::string& pOut, char pValue) { pOut += pValue; }
+inline void appendLogArg(std::string& pOut, double pValue){
+    char lBuffer[32];
+    int lLength = snprintf(lBuffer, sizeof(lBuffer), "%.3f", pValue);
+    pOut.append(lBuffer, lLength);
+}
+template<typename T>
+inline std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>
+appendLogArg(std::string& pOut, T pValue){
+    char lBuffer[24];
+    std::to_chars_result lResult = std::to_chars(lBuffer, lBuffer + sizeof(lBuffer), pValue);
+    pOut.append(lBuffer, lResult.ptr);
+}
+
+inline void formatLogTo(std::string& pOut, const char* pFormat) { pOut += pFormat; }
+
+template<typename T, typename... Rest>
+void formatLogTo(std::string& pOut, const char* pFormat, const T& pArg, const Rest&... pRest){
+    const char* lPlaceholder = strstr(pFormat, "{}");
+    if(!lPlaceholder){ // more arguments than placeholders - the extra ones are ignored
+        pOut += pFormat;
+        return;
+    }
+    pOut.append(pFormat, lPlaceholder - pFormat);
+    appendLogArg(pOut, pArg);
+    formatLogTo(pOut, lPlaceholder + 2, pRest...);
+}
+
 class ILogger{
+    protected:
+        // atomic: changed at runtime by one thread, read by every request thread
+        std::atomic<LOG_LEVEL> mLogLevel{LOG_LEVEL::ERROR};
+
+        // per-thread scratch buffer for logf() - keeps its capacity, so no allocation per line
+        static std::string& formatBuffer();
+
+        // binary mode: logf() hands encoded records to logBinaryRecord() instead of formatting text
+        std::atomic<bool> mBinary{false};
+        virtual void logBinaryRecord(const std::string& pRecord) { (void)pRecord; }
+        static int64_t unixMicros();
+
     public:
         virtual ~ILogger(); // virtual destructor - must for virtual inheritance
         virtual void log(const std::string& pLogMessage, LOG_LEVEL pLogLevel) = 0;
         std::string LogLevelToString(LOG_LEVEL pLogLevel);
+        static const char* levelName(LOG_LEVEL pLogLevel); // same, without the allocation
+
+        void setLogLevel(LOG_LEVEL pLogLevel) { mLogLevel.store(pLogLevel, std::memory_order_relaxed); }
+        bool isEnabled(LOG_LEVEL pLogLevel) const { return pLogLevel <= mLogLevel.load(std::memory_order_relaxed); }
+
+        bool isBinary() const { return mBinary.load(std::memory_order_relaxed); }
+
+        // Checks the level first, formats only if the line will actually be logged.
+        // Prefer the LOG_* macros below: they also skip evaluating the argument expressions, and
+        // pass the call site's pFormatId (from LogFormatRegistry) so binary mode can be used.
+        template<typename... Args>
+        void logf(uint32_t pFormatId, LOG_LEVEL pLogLevel, const char* pFormat, const Args&... pArgs){
+            if(!isEnabled(pLogLevel)) return;
+            std::string& lBuffer = formatBuffer();
+            lBuffer.clear();
+            if(pFormatId != 0 && isBinary()){
+                binlog::appendLogRecord(lBuffer, pFormatId, unixMicros(), pArgs...);
+                logBinaryRecord(lBuffer);
+                return;
+            }
+            formatLogTo(lBuffer, pFormat, pArgs...);
+            log(lBuffer, pLogLevel);
+        }
+
+        template<typename... Args>
+        void logf(LOG_LEVEL pLogLevel, const char* pFormat, const Args&... pArgs){
+            logf(0, pLogLevel, pFormat, pArgs...); // unregistered format - always text
+        }
+};
+
+// Logging front end - when the level is off, a call costs one atomic load and a branch:
+// no string is built, no argument is even evaluated. pLogger may be a (smart) pointer or null.
+// pFormat must be a string literal: it is registered once per call site (the static below) and
+// binary logs refer to it by id.
+//   LOG_INFO(mLogger, "{} {} - {}", req.method, req.path, res.status);
+#define LOG_AT(pLogger, pLevel, pFormat, ...)                                  \
+    do {                                                                       \
+        if((pLogger) && (pLogger)->isEnabled(pLevel)){                         \
+            static const uint32_t sLogFormatId =                               \
+                LogFormatRegistry::getInstance().registerFormat(pFormat, pLevel); \
+            (pLogger)->logf(sLogFormatId, (pLevel), pFormat, ##__VA_ARGS__);   \
+        }                                                                      \
+    } while(0)
+
+#define LOG_ERROR(pLogger, ...)   LOG_AT(pLogger, LOG_LEVEL::ERROR, __VA_ARGS__)
+#define LOG_WARNING(pLogger, ...) LOG_AT(pLogger, LOG_LEVEL::WARNING, __VA_ARGS__)
+#define LOG_INFO(pLogger, ...)    LOG_AT(pLogger, LOG_LEVEL::INFO, __VA_ARGS__)
+#define LOG_DEBUG(pLogger, ...)   LOG_AT(pLogger, LOG_LEVEL::DEBUG, __VA_ARGS__)
+
+// What an async logger does when its ring buffer is full
+enum class LogOverflowPolicy {
+    DROP,  // discard the record and count it - request threads never wait on logging
+    BLOCK  // wait until the writer thread frees space - no record is ever lost
+};
+
+// When FileLogger starts a new file segment ("--log-rotate-*" options). 0 = no limit.
+struct LogRotationPolicy {
+    uint64_t maxBytes = 0;                   // rotate once the active segment reaches this size
+    std::chrono::seconds interval{0};        // ...or once it is this old
+    int keepSegments = 0;                    // rotated segments to keep, older ones are deleted (0 = all)
+    bool compress = false;                   // gzip rotated segments (in the background)
 };
 
 // Singleton FileLogger
+// Two modes:
+//  - sync (default): the calling thread formats the line and writes it to the file itself
+//    (one write() per line, under mFileMtx)
+//  - async (enableAsync): the calling thread only formats the line and pushes it into a
+//    lock-free ring; a single background writer thread drains the ring and writes the lines in
+//    large batches. Everything queued is written before disableAsync()/destruction returns.
+// Either mode can write text lines (default) or binary records (enableBinary, see
+// BinaryLogFormat.h - decode with user_service_logdecode).
+//
+// Rotation (enableRotation): the active segment always has the configured path; rotated ones
+// become <path>.1, <path>.2, ... (newest = highest, ".gz" when compressed). The next segment is
+// created and preallocated (fallocate) ahead of time by a background thread, so rotating is just
+// an atomic swap of mLogFd on the writing thread - renaming, closing, compressing and deleting
+// old segments all happen in the background.
 class FileLogger: public ILogger{
     std::mutex mFileMtx;
-    std::ofstream mLogFile;
-    LOG_LEVEL mLogLevel;
+    std::atomic<int> mLogFd{-1};   // raw fd: the async writer batches many lines into one write() call
+    std::string mLogPath;
+
+    // ---- rotation ----
+    LogRotationPolicy mRotationPolicy;
+    std::atomic<bool> mRotationEnabled{false};
+    std::atomic<bool> mRotating{false};               // one rotation at a time, others just skip
+    std::atomic<int> mNextFd{-1};                     // preallocated next segment, -1 = not ready yet
+    std::atomic<uint64_t> mSegmentBytes{0};
+    std::atomic<int64_t> mSegmentDeadline{0};         // steady_clock ns, 0 = no time limit
+    std::thread mRotationThread;
+    std::mutex mRotationMtx;
+    std::condition_variable mRotationWakeup;
+    std::vector<int> mRetiredFds;                     // guarded by mRotationMtx
+    bool mStopRotation = false;                       // guarded by mRotationMtx
+    uint64_t mSegmentSequence = 0;                    // rotation thread only
+
+    // ---- async mode ----
+    std::unique_ptr<MpscRing> mRing;                  // allocated once, lives as long as the logger
+    std::atomic<bool> mAsync{false};
+    // Threads pushing into the ring right now - disableAsync() waits until the sum is 0.
+    // Sharded like the metrics (one cache line per shard, a thread always uses the same one), so
+    // async producers don't all bounce a single line; sync-mode writes don't touch it at all.
+    struct alignas(64) ProducerShard {
+        std::atomic<int> count{0};
+    };
+    std::array<ProducerShard, METRIC_SHARD_COUNT> mAsyncProducers;
+    LogOverflowPolicy mOverflowPolicy = LogOverflowPolicy::DROP;
+    std::thread mWriterThread;
+    std::atomic<bool> mStopWriter{false};
+    std::atomic<bool> mWriterIdle{false};   // writer is (about to be) sleeping - producers wake it
+    std::mutex mWriterMtx;                  // only used for the writer's sleep, never by producers' fast path
+    std::condition_variable mWriterWakeup;
+
+    static constexpr size_t WRITE_BATCH_BYTES = 64 * 1024;
+
+    // ---- line format ----
+    // " [2026-10-19T09:57:12.123Z] [INFO]: msg" - ISO-8601 UTC, millisecond precision.
+    // With monotonic offsets: " [2026-10-19T09:57:12.123Z +12.345678] [INFO]: msg", the offset
+    // being seconds since the logger started on the steady clock (immune to NTP/clock jumps,
+    // good for measuring gaps between lines).
+    std::atomic<bool> mMonotonicOffsets{false};
+    const std::chrono::steady_clock::time_point mStartTime = std::chrono::steady_clock::now();
+
+    void formatLine(std::string& pOut, const std::string& pLogMessage, LOG_LEVEL pLogLevel) const;
 
     static std::shared_ptr<FileLogger> mInstance; // private - global point of access
 
     FileLogger(std::string& pLogFilePath);
+
+    void writeAll(const char* pData, size_t pLength);
+    static void writeFd(int pFd, const char* pData, size_t pLength);
+    void maybeRotate();
+    void rotationLoop();
+    void prepareNextSegment();
+    std::string pendingSegmentPath() const { return mLogPath + ".next"; }
+    // writes (sync) or queues (async) one record; pNeverDrop ignores the DROP policy - used for
+    // the binary header/definitions, without which the rest of the file can't be decoded
+    void writeRecord(const std::string& pRecord, bool pNeverDrop = false);
+    void enqueue(const std::string& pLine, bool pNeverDrop);
+    void writerLoop();
+
+    void logBinaryRecord(const std::string& pRecord) override;
+
     public:
         ~FileLogger();
         static std::shared_ptr<FileLogger> getInstance(std::string& pLogFilePath);
         void log(const std::string& pLogMessage, LOG_LEVEL pLogLevel) override;
-        void setLogLevel(LOG_LEVEL pLogLevel);
+
+        void setMonotonicOffsets(bool pEnabled) { mMonotonicOffsets.store(pEnabled, std::memory_order_relaxed); }
+
+        // Switches the rest of the file to binary records. One way - call once, at startup.
+        void enableBinary();
+
+        // Starts rotating segments by size and/or age. Call once, at startup.
+        void enableRotation(const LogRotationPolicy& pPolicy);
+
+        // Switches to async mode with a ring of pCapacity records (rounded up to a power of 2).
+        // The ring is allocated by the first call; later calls reuse it and ignore pCapacity.
+        void enableAsync(size_t pCapacity = 8192, LogOverflowPolicy pPolicy = LogOverflowPolicy::DROP);
+        // Back to sync mode - flushes every queued record and stops the writer thread
+        void disableAsync();
+        bool isAsync() const { return mAsync.load(std::memory_order_acquire); }
+
+        // records discarded because the ring was full (DROP policy)
+        // (also exposed on /metrics as user_service_log_records_dropped_total)
+        uint64_t droppedRecords() const;
 
         static std::mutex sObjMutex;
 };
@@ -0,0 +1,129 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Prometheus-style metrics, exposed as text on GET /metrics.
+//
+// Recording is on the hot path of every request, so it must be (almost) free:
+//   - no locks: every counter/bucket is a relaxed atomic
+//   - no contention: each metric is split into SHARD_COUNT cache-line sized shards and every
+//     thread writes to "its" shard, so two worker threads never bounce the same cache line
+//   - no lookups: call sites keep a reference to the metric (registered once, never freed)
+// Reading (a scrape) sums the shards - slower, but happens every few seconds at most.
+
+// number of shards per metric - a power of two, indexed by a per-thread slot
+constexpr size_t METRIC_SHARD_COUNT = 16;
+
+// per-thread shard index, assigned round-robin the first time a thread records something
+size_t metricShardIndex();
+
+// Monotonic counter (Prometheus "counter")
+class ShardedCounter{
+    struct alignas(64) Shard {     // alignas(64): one cache line per shard, no false sharing
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, METRIC_SHARD_COUNT> mShards;
+
+    public:
+        void add(uint64_t pDelta = 1){
+            mShards[metricShardIndex()].value.fetch_add(pDelta, std::memory_order_relaxed);
+        }
+        uint64_t value() const;
+};
+
+// HDR-style latency histogram with log-linear buckets (unit: microseconds).
+// Every power of two [2^k, 2^(k+1)) is split into 8 linear sub-buckets, so any recorded value
+// is known with <= 12.5% relative error, over the whole range 1us .. ~2 minutes, with a fixed
+// 208 buckets - no configuration of bucket boundaries needed per metric.
+class LatencyHistogram{
+    public:
+        static constexpr int SUB_BUCKET_BITS = 3;
+        static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;  // 8
+        static constexpr int MAX_EXPONENT = 27;                    // 2^27 us ~= 134 s
+        static constexpr int BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+        void record(uint64_t pMicros);
+        void recordDuration(std::chrono::steady_clock::duration pDuration){
+            record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(pDuration).count());
+        }
+
+        // merged (all shards) view, used by the exposition code
+        struct Snapshot {
+            std::vector<uint64_t> buckets;
+            uint64_t count = 0;
+            uint64_t sumMicros = 0;
+
+            uint64_t countAtOrBelow(uint64_t pMicros) const; // cumulative count for "le" buckets
+            double quantileMicros(double pQuantile) const;    // e.g. 0.99 -> p99
+        };
+        Snapshot snapshot() const;
+
+        static int bucketIndex(uint64_t pMicros);
+        static uint64_t bucketUpperBound(int pIndex); // exclusive upper edge, in microseconds
+
+    private:
+        struct alignas(64) Shard {
+            std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> sumMicros{0};
+        };
+        std::array<Shard, METRIC_SHARD_COUNT> mShards;
+};
+
+// RAII helper - records the lifetime of the scope into a histogram
+class ScopedLatency{
+    LatencyHistogram& mHistogram;
+    std::chrono::steady_clock::time_point mStart;
+
+    public:
+        explicit ScopedLatency(LatencyHistogram& pHistogram)
+            : mHistogram(pHistogram), mStart(std::chrono::steady_clock::now()) {}
+        ~ScopedLatency(){
+            mHistogram.recordDuration(std::chrono::steady_clock::now() - mStart);
+        }
+};
+
+// Singleton registry of all metrics + the Prometheus text exposition
+class MetricsRegistry{
+    public:
+        static MetricsRegistry& getInstance();
+
+        // Returns the metric for (name, labels), creating it on first use. The reference stays
+        // valid for the lifetime of the process - call once and keep it, this takes a lock.
+        // pLabels is the already formatted label set, e.g.: route="/health",status="2xx"
+        ShardedCounter& counter(const std::string& pName, const std::string& pHelp, const std::string& pLabels = "");
+        LatencyHistogram& histogram(const std::string& pName, const std::string& pHelp, const std::string& pLabels = "");
+
+        // Gauges are sampled at scrape time, e.g. the current thread-pool queue depth
+        void gauge(const std::string& pName, const std::string& pHelp, const std::string& pLabels, std::function<double()> pSampler);
+
+        // Prometheus text exposition format (version 0.0.4)
+        std::string render() const;
+
+    private:
+        MetricsRegistry() = default;
+
+        template<typename T>
+        struct Family {
+            std::string help;
+            std::map<std::string, std::unique_ptr<T>> series; // labels -> metric
+        };
+        using GaugeSampler = std::function<double()>;
+
+        mutable std::mutex mMtx; // guards registration and rendering, never taken while recording
+        std::map<std::string, Family<ShardedCounter>> mCounters;
+        std::map<std::string, Family<LatencyHistogram>> mHistograms;
+        std::map<std::string, Family<GaugeSampler>> mGauges;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Bounded lock-free multi-producer / single-consumer ring of byte records (log lines).
+//
+// Based on Dmitry Vyukov's bounded queue: every cell carries a sequence number that tells
+// producers and the consumer whose turn it is, so a push is one CAS on the tail plus a copy,
+// and nobody ever takes a lock. Cells own a std::string whose capacity is reused, so after
+// warm-up pushing a record does not allocate.
+class MpscRing{
+    public:
+        // pCapacity is rounded up to a power of two
+        explicit MpscRing(size_t pCapacity);
+
+        // Producer side - any thread. Returns false if the ring is full.
+        bool tryPush(const char* pData, size_t pLength);
+
+        // Consumer side - only ever called from ONE thread.
+        // Appends the oldest record to pOut and returns true, or returns false if empty.
+        bool tryPopInto(std::string& pOut);
+
+        bool empty() const; // consumer side too
+        size_t capacity() const { return mMask + 1; }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            std::string data;
+        };
+
+        std::unique_ptr<Cell[]> mCells;
+        size_t mMask;
+
+        // head and tail on separate cache lines - producers and the consumer don't fight over them
+        alignas(64) std::atomic<size_t> mEnqueuePos{0};
+        alignas(64) size_t mDequeuePos = 0; // consumer-only, no atomics needed
+};
+
+#endif
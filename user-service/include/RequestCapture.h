@@ -0,0 +1,90 @@
+#ifndef REQUEST_CAPTURE_H
+#define REQUEST_CAPTURE_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+#include "ContentCodec.h"
+
+// Records incoming requests as JSON lines, so that production traffic can be replayed later
+// (user_service_replay) with its real mix, bodies and arrival times. One line per request:
+//   {"ts_us":1760000000123456,"method":"POST","target":"/users",
+//    "headers":{"Content-Type":"application/json"},
+//    "body":{"username":"u5c0e9f1a7b3d2e44","email":"u0b6f3c9e2d7a1f58@example.invalid","password":"<redacted>"},
+//    "status":201,"latency_us":98123}
+// Bodies are decoded (JSON, MessagePack or CBOR) and stored as JSON with secrets replaced,
+// "encoding" says what they were on the wire. Only headers that change how the service
+// answers are kept - never Authorization or cookies. A body that doesn't decode is not stored
+// at all (it might contain anything), only "body_invalid":true, and replays as garbage.
+// Personal data - email/username body fields, the email, username, username_prefix and q
+// query parameters, the username inside a username_prefix cursor - is replaced with
+// pseudonyms: a keyed hash (BLAKE2b) of the value. The same email gets the same pseudonym
+// throughout a capture, so a signup and its later lookups still match on replay, but without
+// the key (random per server start, never written) a pseudonym can't be reversed or checked
+// against a list of known addresses.
+// Only whole values keep matching, though: the pseudonym of a prefix or substring is not a
+// prefix or substring of anything. GET /users?username_prefix=, /users/suggest?q= and
+// /users/search?q= requests replay with the same status but find nothing - the empty-result
+// path, not the captured work (see replayFaithful(); the replay report marks those routes).
+class RequestCapture{
+    public:
+        static constexpr const char* REDACTED = "<redacted>";
+
+        // one captured request, as read back by load()
+        struct Entry {
+            int64_t tsMicros = 0;           // unix epoch, when the request started
+            std::string method;
+            std::string target;             // path + query string
+            httplib::Headers headers;
+            bool hasBody = false;
+            bool bodyInvalid = false;
+            nlohmann::json body;
+            BodyEncoding encoding = BodyEncoding::JSON;
+            int status = 0;                 // what the service answered at capture time
+            int64_t latencyMicros = 0;
+        };
+
+        // throws runtime_error if the file can't be opened (it is appended to).
+        // pPseudonymKey: from newPseudonymKey(); pass the same one to every --workers process
+        // so their files agree on pseudonyms. Empty: a new random key.
+        explicit RequestCapture(const std::string& pPath, const std::string& pPseudonymKey = "");
+
+        static std::string newPseudonymKey();
+
+        // Called after the response is written. pElapsed: time since the request started.
+        void record(const httplib::Request& req, const httplib::Response& res,
+                    std::chrono::steady_clock::duration pElapsed);
+
+        // throws runtime_error on an unreadable file or a malformed line
+        static std::vector<Entry> load(const std::string& pPath);
+
+        // the wire bytes for a captured body, in its original encoding
+        static std::string encodeBody(const Entry& pEntry);
+
+        // replaces the value of every "password"/"secret"/"token" key, at any depth
+        static void redact(nlohmann::json& pJson);
+
+        // pseudonymizes every "email"/"username" string value, at any depth
+        void pseudonymize(nlohmann::json& pJson) const;
+        // path + query string with the personal query parameters pseudonymized
+        std::string pseudonymizeTarget(const std::string& pTarget) const;
+        // "u" + 16 hex digits, or "u<hex>@example.invalid" - still valid as username/email
+        std::string pseudonym(const std::string& pValue, bool pEmail) const;
+        std::string pseudonymizeCursor(const std::string& pCursor) const;
+
+        // false for targets whose lookup can't be reproduced from pseudonyms: a username_prefix
+        // or q (suggest/search) query parameter
+        static bool replayFaithful(const std::string& pTarget);
+
+    private:
+        std::mutex mMutex;
+        std::ofstream mOut;
+        std::string mPseudonymKey;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef REQUEST_THREAD_POOL_H
+#define REQUEST_THREAD_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <httplib.h>
+
+// Drop-in replacement for httplib::ThreadPool (installed through Server::new_task_queue).
+// Same model - a fixed set of threads taking connection tasks from a FIFO queue - but it
+// exposes its saturation: how many tasks are waiting, how many threads are busy, and how
+// long each task waited in the queue (for queue-deadline load shedding).
+class RequestThreadPool: public httplib::TaskQueue{
+    public:
+        explicit RequestThreadPool(size_t pThreadCount);
+        ~RequestThreadPool() override;
+
+        bool enqueue(std::function<void()> pTask) override;
+        void shutdown() override; // runs the tasks already queued, then joins the threads
+
+        // Saturation of the most recently created pool - read by the /metrics gauges.
+        // (httplib creates one pool per listen() call, i.e. one per process.)
+        static size_t queueDepth() { return sQueueDepth.load(std::memory_order_relaxed); }
+        static size_t busyThreads() { return sBusyThreads.load(std::memory_order_relaxed); }
+        static size_t threadCount() { return sThreadCount.load(std::memory_order_relaxed); }
+
+        // How long the task running on this thread waited in the queue before a thread picked
+        // it up. Returns it once and then zero: a task is a whole keep-alive connection, and
+        // only its first request actually waited in the queue.
+        static std::chrono::steady_clock::duration takeQueueWait();
+
+    private:
+        std::vector<std::thread> mThreads;
+        struct Task {
+            std::function<void()> fn;
+            std::chrono::steady_clock::time_point enqueuedAt;
+        };
+        std::deque<Task> mTasks;
+        std::mutex mMtx;
+        std::condition_variable mCondition;
+        bool mShutdown = false;
+
+        static std::atomic<size_t> sQueueDepth;
+        static std::atomic<size_t> sBusyThreads;
+        static std::atomic<size_t> sThreadCount;
+
+        void workerLoop();
+};
+
+#endif
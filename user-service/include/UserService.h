@@ -2,30 +2,169 @@
 #define USERSERVICE_H
 
 #include <httplib.h>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <nlohmann/json.hpp>
 #include "Database.h"
 #include "Logger.h"
 #include "PasswordService.h"
+#include "ContentCodec.h"
+#include "Metrics.h"
+#include "AccessLogSampler.h"
+#include "RequestCapture.h"
+#include "UsernameIndex.h"
 
 using namespace httplib;
 using json = nlohmann::json;
 
+// User -> JSON object (used implicitly by json lJson = user;)
+void to_json(json& pJson, const User& pUser);
+
 class UserService{
     std::unique_ptr<Database> mDatabaseObj;
     std::shared_ptr<ILogger> mLogger;
     std::unique_ptr<PasswordService> mPasswordService;
 
+    // Per-route state - resolved once in setupRoutes, used lock-free per request:
+    // metric series + admission control (concurrency limit)
+    struct RouteState {
+        ShardedCounter* requestsByStatusClass[5] = {}; // 1xx .. 5xx
+        LatencyHistogram* latency = nullptr;
+        ShardedCounter* shedQueueDeadline = nullptr;
+        ShardedCounter* shedConcurrency = nullptr;
+        std::shared_ptr<std::atomic<int>> inFlight;     // shared_ptr: atomics are not copyable
+        int maxInFlight = 0;                            // 0 = unlimited
+        // access log sampling per status class, nullptr = log every request
+        std::shared_ptr<AccessLogSampler> logSamplers[5];
+        ShardedCounter* logSampledOut[5] = {};
+    };
+    std::unordered_map<std::string, RouteState> mRoutes; // "METHOD pattern" -> state
+    RouteState mUnmatchedRoute;
+
+    // The routes in registration order - handed to httplib by setupRoutes, and matched by
+    // dispatch() for requests that don't come through a socket (replay, benchmarks)
+    struct RouteEntry {
+        std::string method;
+        std::string pattern;
+        std::regex regex;
+        bool literal;            // no regex syntax in pattern - dispatch() compares strings
+        Server::Handler handler;
+    };
+    std::vector<RouteEntry> mRouteTable;
+    std::once_flag mRoutesBuilt;
+
+    // admission control settings, applied in addRoute
+    std::unordered_map<std::string, int> mConcurrencyLimits; // "METHOD label" -> max in flight
+    std::chrono::milliseconds mMaxQueueWait{5000};           // 0 = never shed on queue time
+
+    // access log sampling, applied in addRoute
+    std::unordered_map<std::string, std::string> mAccessLogRules; // "METHOD label[ Nxx]" -> rule
+    std::chrono::milliseconds mSlowRequestLogThreshold{500};      // always logged above this
+
+    bool mServerTimingEnabled = true;
+
+    std::shared_ptr<RequestCapture> mCapture; // nullptr = not capturing
+
+    std::atomic<bool> mReady{true}; // GET /ready - false while warming up
+
+    std::string mAdminToken; // bearer token for /admin/* - empty = admin endpoints disabled
+
+    // GET /users/suggest - loaded from the users table at startup, new signups are added as
+    // they happen, rows committed by other connections (--workers) are caught up on demand
+    UsernameIndex mUsernameIndex;
+    std::mutex mUsernameIndexSyncMtx;
+    int mUsernameIndexLoadedId = 0;                        // rows up to this id are loaded
+    std::atomic<int64_t> mUsernameIndexDataVersion{INT64_MIN}; // data_version of the last catch-up
+
     public:
         UserService(const std::string& pDbPath, std::string& pLogPath);
         void setupRoutes(httplib::Server& pServer);
 
+        // "Server-Timing" response header with the per-phase breakdown (default: on)
+        void setServerTiming(bool pEnabled);
+
+        // Admission control - call before setupRoutes.
+        // pRoute is "METHOD label", e.g. "POST /users"; pMaxInFlight = 0 removes the limit.
+        void setConcurrencyLimit(const std::string& pRoute, int pMaxInFlight);
+        // requests whose connection waited longer than this in the thread-pool queue get a 503
+        void setMaxQueueWait(std::chrono::milliseconds pMaxQueueWait);
+
+        // Access log sampling - call before setupRoutes.
+        // pRoute is "METHOD label" (2xx + 3xx) or "METHOD label Nxx", pRule "1/N" or "R/s"
+        // (see AccessLogSampler). 4xx/5xx responses of a route without an explicit "4xx"/"5xx"
+        // rule, and requests slower than the slow threshold, are always logged.
+        void setAccessLogSampling(const std::string& pRoute, const std::string& pRule);
+        void setSlowRequestLogThreshold(std::chrono::milliseconds pThreshold);
+
+        // Prewarms the database (statements, pages, row versions - see Database::prewarm) and
+        // then reports ready. Run it before listen(), or on a thread after setReady(false).
+        void warmUp();
+        // GET /ready answers 503 while false (load balancers keep traffic away); /health is unaffected
+        void setReady(bool pReady);
+
+        // Enables /admin/* for requests with "Authorization: Bearer <pToken>"
+        void setAdminToken(const std::string& pToken);
+
+        // Records every request (sanitized) to pCapture, see RequestCapture
+        void setCapture(std::shared_ptr<RequestCapture> pCapture);
+
+        // Runs one request through the service without a socket: routing, admission control,
+        // the handler and the same hooks (metrics, access log, capture) the server runs.
+        // Needs req.method, req.target (or req.path), headers and body; fills res.
+        // Thread safe - the first call builds the route table if setupRoutes didn't.
+        void dispatch(Request& req, Response& res);
+
     private:
         // Functions to handle different endpoints
         void handleHealthCall(const Request& req, Response& res);
+        void handleReady(const Request& req, Response& res);
         void handleCreateUser(const Request& req, Response& res);
         void handleGetUser(const Request& req, Response& res);
-        void logMessage(const Request& req, const Response& res);
+        void handleListUsers(const Request& req, Response& res);
+        void handleSuggestUsers(const Request& req, Response& res);
+        void handleSearchUsers(const Request& req, Response& res);
+        void handleExport(const Request& req, Response& res);
+        void handleMetrics(const Request& req, Response& res);
+        void logMessage(const Request& req, const Response& res, const RouteState& pRoute);
+
+        // loads users added by other connections into mUsernameIndex (all of them the first time)
+        void syncUsernameIndex();
+
+        void buildRoutes();
+        void addRoute(const std::string& pMethod, const std::string& pPattern,
+                      const std::string& pLabel, Server::Handler pHandler);
+        static RouteState makeRouteState(const std::string& pLabel);
+        const RouteState& routeFor(const Request& req) const;
+        void recordMetrics(const Request& req, const Response& res, const RouteState& pRoute);
+        Server::HandlerResponse admitRequest(const Request& req, Response& res);
+        // server hooks, see setupRoutes
+        void beginRequest(const Request& req);
+        void finishHandler(const Request& req, Response& res);
+        void finishRequest(const Request& req, const Response& res);
+        void rejectOverloaded(const Request& req, Response& res, const std::string& pMessage);
+        bool isAdmin(const Request& req) const;
+
+        // writes pBody into res using the encoding negotiated from the Accept header
+        void sendResponse(const Request& req, Response& res, const json& pBody);
+
+        // ETag helpers for conditional GETs
+        static std::string makeETag(int pUserId, int64_t pVersion, BodyEncoding pEncoding);
+        static bool etagMatches(const std::string& pIfNoneMatch, const std::string& pETag);
+
+        // list endpoints: "limit" query parameter (1..100) and opaque page cursors
+        static int pageLimit(const Request& req, int pDefault = 20);
+        static std::string encodeCursor(const UsernameCursor& pCursor);
+        static UsernameCursor decodeCursor(const std::string& pCursor); // throws invalid_argument
+        static std::string encodeCreatedAtCursor(const CreatedAtCursor& pCursor);
+        static CreatedAtCursor decodeCreatedAtCursor(const std::string& pCursor); // throws invalid_argument
+        // created_after/created_before: epoch milliseconds or "YYYY-MM-DD[( |T)HH:MM:SS[Z]]" (UTC)
+        static int64_t parseTimestamp(const std::string& pValue); // throws invalid_argument
 
 };
 
@@ -0,0 +1,51 @@
+#ifndef USERNAME_INDEX_H
+#define USERNAME_INDEX_H
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// In-memory type-ahead index: normalized username -> user ids, as a compressed trie (radix
+// tree). Every edge holds a whole run of characters instead of one, so "alexander" and
+// "alexandra" share one "alexand" node and a node exists only where names branch or end.
+// A lookup walks at most strlen(prefix) characters and then collects the first K names below
+// that node - independent of the number of users, a few microseconds where LIKE 'q%' on SQLite
+// needs an index range scan plus a row fetch per match.
+//
+// Keys are normalized like the username index in SQLite (ASCII case folded, surrounding
+// whitespace trimmed), the original spelling is kept for display.
+// Many readers, rare writers: suggest() takes a shared lock, insert() an exclusive one.
+class UsernameIndex{
+    public:
+        struct Suggestion {
+            int id;
+            std::string username; // as stored, not normalized
+        };
+
+        UsernameIndex();
+        ~UsernameIndex();
+
+        static std::string normalize(const std::string& pUsername);
+
+        // no-op if this id is already stored under this name (safe to replay rows)
+        void insert(const std::string& pUsername, int pId);
+
+        // up to pLimit users whose normalized name starts with normalize(pPrefix), in name order
+        // (shorter names first, ties by id)
+        std::vector<Suggestion> suggest(const std::string& pPrefix, size_t pLimit) const;
+
+        size_t size() const;       // stored users
+        size_t nodeCount() const;
+
+    private:
+        struct Node;
+        static void collect(const Node& pNode, size_t pLimit, std::vector<Suggestion>& pOut);
+
+        std::unique_ptr<Node> mRoot;
+        size_t mSize = 0;
+        size_t mNodeCount = 1;
+        mutable std::shared_mutex mMutex;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef WORKER_SUPERVISOR_H
+#define WORKER_SUPERVISOR_H
+
+#include <functional>
+#include <vector>
+#include <csignal>
+#include <sys/types.h> // pid_t
+
+// Pre-fork supervisor for "--workers N" mode.
+// The parent process forks N children; every child runs its own httplib::Server bound to the
+// same port with SO_REUSEPORT, so the kernel load-balances incoming connections across them
+// (and therefore across cores). The parent never serves traffic, it only:
+//   1. restarts children that exit/crash while the service is running
+//   2. forwards SIGINT/SIGTERM to all children so they drain and stop gracefully
+//   3. waits for every child to exit before returning
+class WorkerSupervisor{
+    public:
+        // Entry point for a child process: receives the worker index [0, N) and returns the
+        // process exit code.
+        using WorkerMain = std::function<int(int)>;
+
+        // upper bound for "--workers" - also the size of the pid table used by the signal handler
+        static constexpr int MAX_WORKERS = 256;
+
+        WorkerSupervisor(int pWorkerCount, WorkerMain pWorkerMain);
+
+        // Forks the workers and supervises them until a shutdown signal is received.
+        // Returns the exit code for the parent process.
+        int run();
+
+    private:
+        int mWorkerCount;
+        WorkerMain mWorkerMain;
+        std::vector<pid_t> mWorkerPids;        // index = worker index, 0 = not running
+        std::vector<time_t> mWorkerStartTimes; // used to back off when a worker keeps crashing
+        std::vector<int> mCrashCounts;
+
+        // seconds a child is given to drain in-flight requests before it gets SIGKILL
+        static constexpr int SHUTDOWN_GRACE_SECONDS = 30;
+
+        // Signal handler state - only async-signal-safe types/functions are touched from the handler
+        static volatile sig_atomic_t sShutdownSignal;
+        static volatile pid_t sWorkerPids[MAX_WORKERS];
+
+        static void handleShutdownSignal(int pSigNum);
+
+        pid_t spawnWorker(int pWorkerIndex);
+        int workerIndexOf(pid_t pPid) const;
+        void stopWorkers();
+};
+
+#endif
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+# Admission control check for streamed responses (also: cmake --build <build> --target export-limit-check)
+#   ./scripts/export-limit-check.sh <build dir>
+#
+# GET /admin/export has a concurrency limit of 1, and its slot has to stay taken while the body
+# streams - not only while the handler runs. Starts a server on a seeded DB, keeps one export
+# busy with a rate-limited client and expects a second, concurrent export to get 503 and the
+# in-flight gauge to read 1. Needs curl and the sqlite3 shell.
+set -euo pipefail
+
+BUILD_DIR=$(cd "${1:?build dir}" && pwd)
+PORT=${EXPORT_CHECK_PORT:-18557}
+ROWS=${EXPORT_CHECK_ROWS:-200000}
+TOKEN=export-check
+WORK_DIR=$(mktemp -d)
+SERVER_PID=
+SLOW_PID=
+cleanup(){
+    if [[ -n "$SLOW_PID" ]]; then kill "$SLOW_PID" 2>/dev/null || true; wait "$SLOW_PID" 2>/dev/null || true; fi
+    if [[ -n "$SERVER_PID" ]]; then kill -TERM "$SERVER_PID" 2>/dev/null || true; wait "$SERVER_PID" 2>/dev/null || true; fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+fail(){ echo "FAILED: $*"; exit 1; }
+
+start_server(){
+    (cd "$WORK_DIR" && exec "$BUILD_DIR/user_service" "$WORK_DIR/export.db" 0 "$PORT" --admin-token "$TOKEN" >/dev/null) &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        curl -s -o /dev/null "http://localhost:$PORT/health" && return
+        sleep 0.1
+    done
+    fail "server did not start"
+}
+
+# first start creates the schema, then enough rows that the export outlives socket buffers
+start_server
+kill -TERM "$SERVER_PID"; wait "$SERVER_PID" 2>/dev/null || true; SERVER_PID=
+sqlite3 "$WORK_DIR/export.db" "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < $ROWS)
+    INSERT INTO users (username, email, password, created_at_ms) SELECT 'export' || i, 'export' || i || '@example.com', 'x', 1 FROM n;"
+start_server
+
+curl -s -o /dev/null --limit-rate 200k -H "Authorization: Bearer $TOKEN" "http://localhost:$PORT/admin/export" &
+SLOW_PID=$!
+sleep 1
+kill -0 "$SLOW_PID" 2>/dev/null || fail "first export finished too early - raise EXPORT_CHECK_ROWS"
+
+IN_FLIGHT=$(curl -s "http://localhost:$PORT/metrics" | awk '/^user_service_http_requests_in_flight\{route="\/admin\/export"\}/ {print $2}')
+[[ "$IN_FLIGHT" == "1" ]] || fail "in-flight gauge for /admin/export is '$IN_FLIGHT' while an export streams, expected 1"
+
+STATUS=$(curl -s -o /dev/null -w "%{http_code}" -H "Authorization: Bearer $TOKEN" "http://localhost:$PORT/admin/export")
+[[ "$STATUS" == "503" ]] || fail "second concurrent export got $STATUS, expected 503"
+
+# once the first one is gone the slot is free again
+kill "$SLOW_PID" 2>/dev/null || true; wait "$SLOW_PID" 2>/dev/null || true; SLOW_PID=
+sleep 0.5
+STATUS=$(curl -s -o /dev/null -w "%{http_code}" -H "Authorization: Bearer $TOKEN" "http://localhost:$PORT/admin/export?format=csv")
+[[ "$STATUS" == "200" ]] || fail "export after the first one ended got $STATUS, expected 200"
+
+echo "export limit check passed"
@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+# Performance regression gate (also: cmake --build <build> --target perf-check)
+#   ./scripts/perf-check.sh <build dir> <baseline json> [--update]
+#
+# Runs the microbenchmarks and the in-process handler benchmark PERF_CHECK_RUNS times (default 3,
+# the best run counts) and a short open-loop load test against a fresh server, then compares
+# everything with the baseline (user_service_perfcheck).
+# Exits non-zero when a metric regressed beyond its tolerance. --update rewrites the baseline
+# from this run instead - do that on the machine the gate runs on, with the same build type.
+set -euo pipefail
+
+BUILD_DIR=$(cd "${1:?build dir}" && pwd)
+BASELINE=${2:?baseline json}
+UPDATE=${3:-}
+PORT=${PERF_CHECK_PORT:-18556}
+RUNS=${PERF_CHECK_RUNS:-3}
+# fixed, not the core count: req/s and p99 of the handler bench scale with threads (the
+# baseline records the count and perfcheck refuses to compare different ones)
+HANDLER_THREADS=${PERF_CHECK_HANDLER_THREADS:-1}
+WORK_DIR=$(mktemp -d)
+SERVER_PID=
+cleanup(){
+    if [[ -n "$SERVER_PID" ]]; then kill -TERM "$SERVER_PID" 2>/dev/null || true; wait "$SERVER_PID" 2>/dev/null || true; fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+INPUTS=()
+echo "==> [1/4] microbenchmarks (x$RUNS)"
+for run in $(seq "$RUNS"); do
+    "$BUILD_DIR/user_service_bench" --json > "$WORK_DIR/bench$run.json"
+    INPUTS+=(--bench "$WORK_DIR/bench$run.json")
+done
+
+echo "==> [2/4] handler benchmark (x$RUNS, $HANDLER_THREADS thread(s))"
+for run in $(seq "$RUNS"); do
+    "$BUILD_DIR/user_service_handler_bench" --json --duration 1 --threads "$HANDLER_THREADS" > "$WORK_DIR/handler$run.json"
+    INPUTS+=(--handler "$WORK_DIR/handler$run.json")
+done
+
+echo "==> [3/4] load test"
+(cd "$WORK_DIR" && exec "$BUILD_DIR/user_service" "$WORK_DIR/load.db" 2 "$PORT" >/dev/null) &
+SERVER_PID=$!
+for _ in $(seq 50); do
+    curl -s -o /dev/null "http://localhost:$PORT/health" && break
+    sleep 0.1
+done
+# reads only: signups are Argon2-bound and would make the latencies depend on core count
+"$BUILD_DIR/user_service_loadgen" --port "$PORT" --seed 20 --rate 300 --duration 5 --connections 8 \
+    --mix "get=80,multi-get=10,health=10" --json > "$WORK_DIR/load.json"
+
+echo "==> [4/4] compare with $BASELINE"
+"$BUILD_DIR/user_service_perfcheck" --baseline "$BASELINE" "${INPUTS[@]}" --load "$WORK_DIR/load.json" $UPDATE
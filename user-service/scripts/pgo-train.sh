@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+# PGO training workload - runs an (instrumented) user_service and sends it a traffic mix that
+# looks like production: mostly user reads (JSON, MessagePack, conditional GETs), some signups,
+# health probes, 404s and metric scrapes. The profile is written when the server exits, so it
+# is stopped with SIGTERM (graceful shutdown), never killed.
+#   ./scripts/pgo-train.sh <path to user_service> [port]
+set -euo pipefail
+
+SERVER=$(cd "$(dirname "${1:?path to user_service}")" && pwd)/$(basename "$1")
+PORT=${2:-18555}
+BASE="http://localhost:$PORT"
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+cd "$WORK_DIR" # the server writes ./logs here
+"$SERVER" "$WORK_DIR/train.db" 2 "$PORT" --log-async 8192 >/dev/null &
+SERVER_PID=$!
+
+for _ in $(seq 50); do
+    curl -s -o /dev/null "$BASE/health" && break
+    sleep 0.1
+done
+
+# signups - Argon2, JSON parsing, inserts (and a few invalid ones for the error paths)
+for i in $(seq 1 40); do
+    curl -s -o /dev/null -X POST "$BASE/users" -H 'Content-Type: application/json' \
+        -d "{\"username\":\"train$i\",\"email\":\"train$i@example.com\",\"password\":\"Train!ng$i\"}"
+done
+curl -s -o /dev/null -X POST "$BASE/users" -H 'Content-Type: application/json' -d '{"username":"x"}'
+curl -s -o /dev/null -X POST "$BASE/users" -H 'Content-Type: application/json' -d 'not json'
+
+# reads, from a few concurrent clients
+read_mix(){
+    for round in $(seq 1 25); do
+        for id in $(seq 1 40); do
+            curl -s -o /dev/null "$BASE/users/$id"
+        done
+        curl -s -o /dev/null -H 'Accept: application/msgpack' "$BASE/users/$round"
+        curl -s -o /dev/null -H "If-None-Match: \"$round-1-JSON\"" "$BASE/users/$round"
+        curl -s -o /dev/null "$BASE/users/99999"
+        curl -s -o /dev/null "$BASE/health"
+    done
+}
+READERS=()
+for _ in 1 2 3 4; do
+    read_mix &
+    READERS+=($!)
+done
+wait "${READERS[@]}"
+curl -s -o /dev/null "$BASE/metrics"
+
+kill -TERM "$SERVER_PID"
+wait "$SERVER_PID" || true
+echo "training run finished"
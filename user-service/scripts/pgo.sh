@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+# Profile-guided optimization pipeline (also: cmake --build <build> --target pgo)
+#   ./scripts/pgo.sh <source dir> <pgo build dir> [c++ compiler]
+#
+# 1. Release build instrumented with -fprofile-generate
+# 2. training run: scripts/pgo-train.sh drives the instrumented server with a representative mix
+# 3. Release rebuild with -fprofile-use, in the SAME build directory - gcc names its profile
+#    files after the object file paths, so both builds must produce identical paths
+set -euo pipefail
+
+SOURCE_DIR=$(cd "${1:?source dir}" && pwd)
+BUILD_DIR=${2:?build dir}
+CXX_COMPILER=${3:-}
+PROFILE_DIR="$BUILD_DIR/profiles"
+JOBS=$(nproc 2>/dev/null || echo 2)
+
+CONFIGURE_ARGS=(-S "$SOURCE_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DUSER_SERVICE_PGO_DIR="$PROFILE_DIR")
+if [[ -n "$CXX_COMPILER" ]]; then
+    CONFIGURE_ARGS+=(-DCMAKE_CXX_COMPILER="$CXX_COMPILER")
+fi
+
+echo "==> [1/3] instrumented build"
+rm -rf "$PROFILE_DIR"
+cmake "${CONFIGURE_ARGS[@]}" -DUSER_SERVICE_PGO=GENERATE
+cmake --build "$BUILD_DIR" -j"$JOBS" --clean-first --target user_service
+
+echo "==> [2/3] training run"
+"$SOURCE_DIR/scripts/pgo-train.sh" "$BUILD_DIR/user_service"
+
+if ls "$PROFILE_DIR"/*.profraw >/dev/null 2>&1; then
+    # clang: raw per-process profiles -> one indexed profile
+    llvm-profdata merge -output="$PROFILE_DIR/merged.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+echo "==> [3/3] optimized build"
+cmake "${CONFIGURE_ARGS[@]}" -DUSER_SERVICE_PGO=USE
+cmake --build "$BUILD_DIR" -j"$JOBS" --clean-first
+
+echo "PGO build ready: $BUILD_DIR/user_service"
@@ -0,0 +1,52 @@
+#include <chrono>
+#include <stdexcept>
+#include "AccessLogSampler.h"
+
+using namespace std;
+
+shared_ptr<AccessLogSampler> AccessLogSampler::parse(const string& pRule){
+    shared_ptr<AccessLogSampler> lSampler(new AccessLogSampler());
+    lSampler->mRule = pRule;
+
+    size_t lSlash = pRule.find('/');
+    if(lSlash == string::npos){
+        throw invalid_argument("Invalid sampling rule (expected 1/N or R/s): " + pRule);
+    }
+    string lLeft = pRule.substr(0, lSlash);
+    string lRight = pRule.substr(lSlash + 1);
+    try{
+        if(lRight == "s"){
+            double lPerSecond = stod(lLeft);
+            if(lPerSecond <= 0) throw invalid_argument("rate must be positive");
+            lSampler->mEmissionIntervalNs = (int64_t)(1e9 / lPerSecond);
+            // burst = one second worth of lines
+            lSampler->mBurstToleranceNs = (int64_t)((max(lPerSecond, 1.0) - 1) * lSampler->mEmissionIntervalNs);
+        }
+        else{
+            if(lLeft != "1") throw invalid_argument("only 1/N is supported");
+            long long lEvery = stoll(lRight);
+            if(lEvery < 1) throw invalid_argument("N must be >= 1");
+            lSampler->mEvery = (uint64_t)lEvery;
+        }
+    }
+    catch(const logic_error&){ // stod/stoll errors and the checks above
+        throw invalid_argument("Invalid sampling rule (expected 1/N or R/s): " + pRule);
+    }
+    return lSampler;
+}
+
+bool AccessLogSampler::shouldLog(){
+    if(mEvery > 0){
+        return mSeen.fetch_add(1, memory_order_relaxed) % mEvery == 0;
+    }
+
+    // GCRA: a line "costs" one emission interval of arrival time; it is allowed as long as the
+    // theoretical arrival time doesn't run more than the burst tolerance ahead of now
+    int64_t lNow = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t lArrival = mTheoreticalArrivalNs.load(memory_order_relaxed);
+    for(;;){
+        int64_t lNext = max(lArrival, lNow) + mEmissionIntervalNs;
+        if(lNext - lNow > mBurstToleranceNs + mEmissionIntervalNs) return false;
+        if(mTheoreticalArrivalNs.compare_exchange_weak(lArrival, lNext, memory_order_relaxed)) return true;
+    }
+}
@@ -0,0 +1,72 @@
+#include "BinaryLogFormat.h"
+
+using namespace std;
+
+void binlog::appendTextRecord(string& pOut, int pLevel, int64_t pUnixMicros, const string& pText){
+    pOut += RECORD_TEXT;
+    appendRaw<uint8_t>(pOut, (uint8_t)pLevel);
+    appendRaw<int64_t>(pOut, pUnixMicros);
+    appendRaw<uint32_t>(pOut, (uint32_t)pText.size());
+    pOut += pText;
+}
+
+void binlog::appendHeader(string& pOut){
+    pOut.append(MAGIC, sizeof(MAGIC));
+    appendRaw<uint32_t>(pOut, VERSION);
+}
+
+LogFormatRegistry& LogFormatRegistry::getInstance(){
+    // never destroyed: loggers (and their destructors) may outlive any static in this file
+    static LogFormatRegistry* sInstance = new LogFormatRegistry();
+    return *sInstance;
+}
+
+uint32_t LogFormatRegistry::registerFormat(const char* pFormat, int pLevel){
+    lock_guard<mutex> lock(mMtx);
+    // one copy per call site, once - cheap enough to keep appendPreamble() off mMtx
+    auto lFormats = make_shared<Formats>(*mFormats);
+    lFormats->push_back({pFormat, pLevel});
+    uint32_t lFormatId = (uint32_t)lFormats->size();
+    atomic_store(&mFormats, shared_ptr<const Formats>(move(lFormats)));
+    if(mSink){
+        // a rotation racing with this either snapshots the new vector (preamble has it) or
+        // happens before this record is written (it lands in the new segment)
+        string lRecord;
+        appendDefinition(lRecord, lFormatId, {pFormat, pLevel});
+        mSink(lRecord);
+    }
+    return lFormatId;
+}
+
+void LogFormatRegistry::attachSink(DefinitionSink pSink){
+    lock_guard<mutex> lock(mMtx);
+    string lRecords;
+    const Formats& lFormats = *mFormats; // registrations are excluded by mMtx
+    for(size_t i = 0; i < lFormats.size(); ++i){
+        appendDefinition(lRecords, (uint32_t)(i + 1), lFormats[i]);
+    }
+    if(!lRecords.empty()) pSink(lRecords);
+    mSink = move(pSink);
+}
+
+void LogFormatRegistry::detachSink(){
+    lock_guard<mutex> lock(mMtx);
+    mSink = nullptr;
+}
+
+void LogFormatRegistry::appendPreamble(string& pOut){
+    shared_ptr<const Formats> lFormats = atomic_load(&mFormats);
+    binlog::appendHeader(pOut);
+    for(size_t i = 0; i < lFormats->size(); ++i){
+        appendDefinition(pOut, (uint32_t)(i + 1), (*lFormats)[i]);
+    }
+}
+
+void LogFormatRegistry::appendDefinition(string& pOut, uint32_t pFormatId, const Entry& pEntry){
+    size_t lLength = strlen(pEntry.format);
+    pOut += binlog::RECORD_DEFINITION;
+    binlog::appendRaw<uint32_t>(pOut, pFormatId);
+    binlog::appendRaw<uint8_t>(pOut, (uint8_t)pEntry.level);
+    binlog::appendRaw<uint32_t>(pOut, (uint32_t)lLength);
+    pOut.append(pEntry.format, lLength);
+}
@@ -0,0 +1,143 @@
+#include <cstdlib>
+#include "ContentCodec.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+bool ContentCodec::fromMediaType(string_view pMediaType, BodyEncoding& pEncoding){
+    // strip parameters, e.g. "application/json; charset=utf-8"
+    string_view lType = pMediaType.substr(0, pMediaType.find(';'));
+    while(!lType.empty() && lType.back() == ' ') lType.remove_suffix(1);
+
+    if(lType == "application/json" || lType == "application/*" || lType == "*/*"){
+        pEncoding = BodyEncoding::JSON;
+        return true;
+    }
+    // "application/x-msgpack" is the older, still widely used name
+    if(lType == "application/msgpack" || lType == "application/x-msgpack"){
+        pEncoding = BodyEncoding::MSGPACK;
+        return true;
+    }
+    if(lType == "application/cbor"){
+        pEncoding = BodyEncoding::CBOR;
+        return true;
+    }
+    return false;
+}
+
+// Accept is parsed here rather than taken from httplib's accept_content_types: that list is
+// sorted by q-value but drops the values and keeps "q=0" entries - and q=0 means "not
+// acceptable". Every encoding gets the q of the most specific range that names it
+// ("application/msgpack" > "application/*" > "*/*"), so "*/*, application/json;q=0" rules JSON
+// out. Highest q wins, then the more specific range, then the earlier entry.
+BodyEncoding ContentCodec::negotiate(const httplib::Request& pReq){
+    auto lHeader = pReq.headers.find("Accept");
+    if(lHeader == pReq.headers.end()) return BodyEncoding::JSON;
+    const string& lAccept = lHeader->second;
+
+    struct Candidate { double q = 0; int specificity = -1; size_t order = 0; };
+    Candidate lCandidates[3]; // indexed by BodyEncoding (JSON, MSGPACK, CBOR)
+
+    size_t lPos = 0, lOrder = 0;
+    while(lPos < lAccept.size()){
+        size_t lEnd = lAccept.find(',', lPos);
+        if(lEnd == string::npos) lEnd = lAccept.size();
+        string_view lEntry(lAccept.data() + lPos, lEnd - lPos);
+        lPos = lEnd + 1;
+
+        size_t lSemicolon = lEntry.find(';');
+        string_view lType = lEntry.substr(0, lSemicolon);
+        while(!lType.empty() && lType.front() == ' ') lType.remove_prefix(1);
+        while(!lType.empty() && lType.back() == ' ') lType.remove_suffix(1);
+        double lQ = 1;
+        while(lSemicolon != string_view::npos){
+            size_t lNext = lEntry.find(';', lSemicolon + 1);
+            string_view lParam = lEntry.substr(lSemicolon + 1, lNext == string_view::npos ? string_view::npos : lNext - lSemicolon - 1);
+            while(!lParam.empty() && lParam.front() == ' ') lParam.remove_prefix(1);
+            if(lParam.size() > 2 && (lParam[0] == 'q' || lParam[0] == 'Q') && lParam[1] == '='){
+                lQ = strtod(lParam.data() + 2, nullptr); // stops at the next ',' or ';'
+            }
+            lSemicolon = lNext;
+        }
+
+        int lSpecificity;
+        BodyEncoding lEncoding;
+        if(lType == "*/*") lSpecificity = 0;
+        else if(lType == "application/*") lSpecificity = 1;
+        else if(fromMediaType(lType, lEncoding)) lSpecificity = 2;
+        else { ++lOrder; continue; }
+
+        for(int e = 0; e < 3; ++e){
+            if(lSpecificity == 2 && (int)lEncoding != e) continue;
+            Candidate& lCandidate = lCandidates[e];
+            if(lSpecificity > lCandidate.specificity){ // the most specific range decides
+                lCandidate = Candidate{lQ, lSpecificity, lOrder};
+            }
+        }
+        ++lOrder;
+    }
+
+    int lBest = -1;
+    for(int e = 0; e < 3; ++e){
+        const Candidate& c = lCandidates[e];
+        if(c.specificity < 0 || c.q <= 0) continue; // not listed, or explicitly not acceptable
+        if(lBest < 0) { lBest = e; continue; }
+        const Candidate& b = lCandidates[lBest];
+        if(c.q > b.q || (c.q == b.q && (c.specificity > b.specificity ||
+                                        (c.specificity == b.specificity && c.order < b.order)))){
+            lBest = e;
+        }
+    }
+    return lBest < 0 ? BodyEncoding::JSON : (BodyEncoding)lBest;
+}
+
+BodyEncoding ContentCodec::requestEncoding(const httplib::Request& pReq){
+    BodyEncoding lEncoding = BodyEncoding::JSON;
+    if(pReq.has_header("Content-Type")){
+        fromMediaType(pReq.get_header_value("Content-Type"), lEncoding);
+    }
+    return lEncoding;
+}
+
+string ContentCodec::encode(const json& pJson, BodyEncoding pEncoding){
+    switch(pEncoding){
+        case BodyEncoding::MSGPACK: {
+            vector<uint8_t> lBytes = json::to_msgpack(pJson);
+            return string(lBytes.begin(), lBytes.end());
+        }
+        case BodyEncoding::CBOR: {
+            vector<uint8_t> lBytes = json::to_cbor(pJson);
+            return string(lBytes.begin(), lBytes.end());
+        }
+        case BodyEncoding::JSON:
+        default:
+            return pJson.dump(4);
+    }
+}
+
+json ContentCodec::decode(const string& pBody, BodyEncoding pEncoding){
+    switch(pEncoding){
+        case BodyEncoding::MSGPACK: return json::from_msgpack(pBody);
+        case BodyEncoding::CBOR:    return json::from_cbor(pBody);
+        case BodyEncoding::JSON:
+        default:                    return json::parse(pBody);
+    }
+}
+
+const char* ContentCodec::contentType(BodyEncoding pEncoding){
+    switch(pEncoding){
+        case BodyEncoding::MSGPACK: return "application/msgpack";
+        case BodyEncoding::CBOR:    return "application/cbor";
+        case BodyEncoding::JSON:
+        default:                    return "application/json";
+    }
+}
+
+const char* ContentCodec::name(BodyEncoding pEncoding){
+    switch(pEncoding){
+        case BodyEncoding::MSGPACK: return "MessagePack";
+        case BodyEncoding::CBOR:    return "CBOR";
+        case BodyEncoding::JSON:
+        default:                    return "JSON";
+    }
+}
@@ -2,11 +2,30 @@
 // #include <exception>
 #include <stdexcept>  // for invalid_argument, and other exceptions
 #include <regex>      // Required for regex functionality
+#include <chrono>
+#include <thread>
+#include <cctype>
+#include "Metrics.h"
+#include "RequestContext.h"
 
 using namespace std;
 
-Database::Database(const string pDBPath){
-    cout<<"Database constructor called !"<<endl;
+// Per-statement timings for /metrics and Server-Timing (prepare + bind + step)
+static LatencyHistogram& statementLatency(const char* pStatement){
+    return MetricsRegistry::getInstance().histogram("user_service_sqlite_statement_duration_seconds",
+        "Time spent executing SQLite statements", string("statement=\"") + pStatement + "\"");
+}
+static LatencyHistogram& sInsertUserLatency = statementLatency("insert_user");
+static LatencyHistogram& sSelectUserLatency = statementLatency("select_user_by_id");
+static LatencyHistogram& sSelectVersionLatency = statementLatency("select_user_version");
+static LatencyHistogram& sSelectByEmailLatency = statementLatency("select_user_by_email");
+static LatencyHistogram& sSelectByUsernameLatency = statementLatency("select_users_by_username_prefix");
+static LatencyHistogram& sSearchUsersLatency = statementLatency("search_users");
+static LatencyHistogram& sSelectByCreatedAtLatency = statementLatency("select_users_by_created_at");
+
+Database::Database(const string pDBPath, shared_ptr<ILogger> pLogger){
+    mLogger = move(pLogger);
+    LOG_DEBUG(mLogger, "Opening database {}", pDBPath);
     
     // Opens SQLite connection in constructor
     int rc = sqlite3_open(pDBPath.c_str(), &mDB);
@@ -18,10 +37,33 @@ Database::Database(const string pDBPath){
         return;
     }
 
-    createTables();
+    configureConnection();
+    migrateSchema();
+
+    // rows that existed before the search index was added are indexed in the background
+    sqlite3_stmt* lPreparedStmt;
+    rc = sqlite3_prepare_v2(mDB, "SELECT 1 FROM search_index_backfill", -1, &lPreparedStmt, nullptr);
+    if(rc != SQLITE_OK){
+        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+    }
+    unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+    if(sqlite3_step(lStmt.get()) == SQLITE_ROW){
+        mSearchIndexComplete = false;
+        mSearchBackfillThread = thread(&Database::backfillSearchIndex, this, pDBPath);
+    }
 }
 
 Database::~Database(){
+    // an unfinished backfill stops after its current batch and resumes with the next start
+    mStopSearchBackfill = true;
+    if(mSearchBackfillThread.joinable()) mSearchBackfillThread.join();
+
+    // every statement has to be finalized first, sqlite3_close() refuses to close otherwise
+    for(StatementSlot& lSlot : mStatementPool){
+        for(sqlite3_stmt* lStmt : lSlot.idle) sqlite3_finalize(lStmt);
+        lSlot.idle.clear();
+    }
+    mDataVersionStmt.reset();
     // Closes connection in destructor
     sqlite3_close(mDB);
 }
@@ -37,30 +79,297 @@ int Database::executeQueryCallback(void* data, int argc, char** argv, char** azc
         cout<<azcolNames[i]<<": "<<argv[i]<<" ";
     }
     cout<<endl;
+    return 0; // non-zero would make sqlite3_exec() abort with SQLITE_ABORT
 }
 
-/// method to create the users table with fields: id, username, email, password, created_at
-void Database::createTables(){
-    cout<<"Executing create table command..."<<endl;
-    string lCreateTableCommand = "CREATE TABLE IF NOT EXISTS users (\
-                                    id INTEGER PRIMARY KEY AUTOINCREMENT, \
-                                    username TEXT NOT NULL,\
-                                    email TEXT NOT NULL UNIQUE,\
-                                    password TEXT NOT NULL,\
-                                    created_at DATETIME DEFAULT CURRENT_TIMESTAMP\
-                                    )";
+/// method to set the connection-level PRAGMAs
+// WAL (Write-Ahead Logging) lets readers run concurrently with a writer, and lets several
+// processes (--workers mode) share the same DB file. journal_mode=WAL is persistent - it is
+// stored in the DB file itself. busy_timeout makes a writer wait (up to 5s) for another
+// process's write lock instead of failing immediately with SQLITE_BUSY.
+void Database::configureConnection(){
     char* errMsg = nullptr;
-    // char* callbackData = "<data from exec()>";
-    // int rc = sqlite3_exec(mDB, lCreateTableCommand.c_str(), executeQueryCallback, callbackData, &errMsg);
-    // Callback is only needed for SELECT queries, no need here
-    int rc = sqlite3_exec(mDB, lCreateTableCommand.c_str(), nullptr, nullptr, &errMsg);
-    if(rc){ // i.e. rc != SQLITE_OK
-        cerr<<"Error creating table: "<<errMsg<<endl;
-        sqlite3_free(errMsg); // **** release errMsg to prevent memory leak !! ****
+    int rc = sqlite3_exec(mDB, "PRAGMA journal_mode=WAL;", nullptr, nullptr, &errMsg);
+    if(rc != SQLITE_OK){
+        string lError = errMsg ? errMsg : sqlite3_errmsg(mDB);
+        sqlite3_free(errMsg);
+        throw runtime_error("Error enabling WAL mode: " + lError);
+    }
+    sqlite3_busy_timeout(mDB, 5000);
+}
+
+// Schema migrations, applied in order by migrateSchema(). PRAGMA user_version (a field in the
+// database header) records the last one applied, so an up to date database costs one pragma
+// read at startup. Append new steps at the end - never change or reorder the existing ones.
+// Steps 1 and 2 are idempotent: databases from before the versioning (user_version 0) may
+// already have the table and the version column.
+const vector<Database::Migration>& Database::migrations(){
+    static const vector<Migration> sMigrations = {
+        {1, "users table", &Database::createUsersTable},
+        {2, "row version column + update trigger", &Database::addVersionTracking},
+        {3, "case-insensitive username index", &Database::addUsernameIndex},
+        {4, "trigram search index", &Database::addSearchIndex},
+        {5, "integer created_at_ms column + index", &Database::addCreatedAtMs},
+    };
+    return sMigrations;
+}
+
+int Database::schemaVersion(){
+    return migrations().back().version;
+}
+
+void Database::migrateSchema(){
+    int64_t lVersion = readUserVersion();
+    if(lVersion == schemaVersion()){
+        LOG_DEBUG(mLogger, "Schema is current (v{})", lVersion);
         return;
     }
-    cout<<"Table created successfully!"<<endl;
-    return;
+    if(lVersion > schemaVersion()){
+        throw runtime_error("Database schema v" + to_string(lVersion) + " is newer than this build (v" +
+                            to_string(schemaVersion()) + ")");
+    }
+
+    // IMMEDIATE: take the write lock up front - another process (--workers, a second instance)
+    // may be migrating the same file right now; whoever comes second sees the new version
+    execute("BEGIN IMMEDIATE;", "starting migration");
+    try{
+        lVersion = readUserVersion();
+        for(const Migration& lMigration : migrations()){
+            if(lMigration.version <= lVersion) continue;
+            LOG_INFO(mLogger, "Migrating schema to v{}: {}", lMigration.version, lMigration.description);
+            auto lStepStart = chrono::steady_clock::now();
+            (this->*lMigration.apply)();
+            LOG_INFO(mLogger, "Schema v{} applied in {}ms", lMigration.version,
+                     chrono::duration<double, milli>(chrono::steady_clock::now() - lStepStart).count());
+        }
+        execute("PRAGMA user_version = " + to_string(schemaVersion()) + ";", "setting schema version");
+        execute("COMMIT;", "committing migration");
+    }
+    catch(...){
+        sqlite3_exec(mDB, "ROLLBACK;", nullptr, nullptr, nullptr); // DDL is transactional in SQLite
+        throw;
+    }
+}
+
+int64_t Database::readUserVersion(){
+    sqlite3_stmt* lPreparedStmt;
+    int rc = sqlite3_prepare_v2(mDB, "PRAGMA user_version;", -1, &lPreparedStmt, nullptr);
+    if(rc != SQLITE_OK){
+        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+    }
+    unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+    return (sqlite3_step(lStmt.get()) == SQLITE_ROW) ? sqlite3_column_int64(lStmt.get(), 0) : 0;
+}
+
+void Database::execute(const string& pSql, const char* pWhat){
+    char* errMsg = nullptr;
+    int rc = sqlite3_exec(mDB, pSql.c_str(), nullptr, nullptr, &errMsg);
+    if(rc != SQLITE_OK){
+        string lError = errMsg ? errMsg : sqlite3_errmsg(mDB);
+        sqlite3_free(errMsg); // **** release errMsg to prevent memory leak !! ****
+        throw runtime_error(string("Error ") + pWhat + ": " + lError);
+    }
+}
+
+/// method to create the users table with fields: id, username, email, password, created_at
+void Database::createUsersTable(){
+    execute("CREATE TABLE IF NOT EXISTS users (\
+                 id INTEGER PRIMARY KEY AUTOINCREMENT, \
+                 username TEXT NOT NULL,\
+                 email TEXT NOT NULL UNIQUE,\
+                 password TEXT NOT NULL,\
+                 created_at DATETIME DEFAULT CURRENT_TIMESTAMP,\
+                 version INTEGER NOT NULL DEFAULT 1\
+                 )", "creating table users");
+}
+
+/// method to add the row version used for ETags
+// Tables created before the column existed get it via ALTER TABLE (every existing row starts at
+// version 1). The trigger bumps the version whenever user-visible fields change, no matter who
+// runs the UPDATE. recursive_triggers is off by default, so the trigger's own UPDATE does not
+// fire it again.
+void Database::addVersionTracking(){
+    bool lHasVersion = false;
+    sqlite3_stmt* lPreparedStmt;
+    int rc = sqlite3_prepare_v2(mDB, "PRAGMA table_info(users);", -1, &lPreparedStmt, nullptr);
+    if(rc != SQLITE_OK){
+        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+    }
+    unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+    while(sqlite3_step(lStmt.get()) == SQLITE_ROW){
+        // table_info columns: cid, name, type, notnull, dflt_value, pk
+        if(string((const char*)sqlite3_column_text(lStmt.get(), 1)) == "version"){
+            lHasVersion = true;
+        }
+    }
+
+    string lCommand;
+    if(!lHasVersion){
+        lCommand += "ALTER TABLE users ADD COLUMN version INTEGER NOT NULL DEFAULT 1;";
+    }
+    lCommand += "CREATE TRIGGER IF NOT EXISTS users_bump_version\
+                 AFTER UPDATE OF username, email, password ON users\
+                 BEGIN\
+                     UPDATE users SET version = OLD.version + 1 WHERE id = NEW.id;\
+                 END;";
+    char* errMsg = nullptr;
+    rc = sqlite3_exec(mDB, lCommand.c_str(), nullptr, nullptr, &errMsg);
+    if(rc != SQLITE_OK){
+        string lError = errMsg ? errMsg : sqlite3_errmsg(mDB);
+        sqlite3_free(errMsg);
+        throw runtime_error("Error adding version column: " + lError);
+    }
+}
+
+/// method to add the index behind username prefix searches
+// NOCASE so "al" finds "Alice" with a plain range scan; id as the tie breaker makes
+// (username, id) unique - the keyset pagination order. Building it reads the whole table once.
+void Database::addUsernameIndex(){
+    execute("CREATE INDEX IF NOT EXISTS users_username_nocase ON users(username COLLATE NOCASE, id);",
+            "creating username index");
+}
+
+
+/// method to add the substring search index (GET /users/search)
+// An FTS5 table with the trigram tokenizer: every 3-character window of username and email is
+// a term, so any substring of 3+ characters is an index lookup instead of a LIKE '%q%' scan.
+// content='users' - the text isn't stored twice, FTS5 reads it from users when it needs it.
+// Triggers keep it in sync with every INSERT/UPDATE/DELETE, whoever runs them.
+//
+// Indexing the existing rows here would hold the write lock for the whole table (other
+// --workers processes couldn't write meanwhile). So this step only records the id range that
+// predates the index in search_index_backfill, and backfillSearchIndex() indexes it later in
+// small batches. The triggers only touch rows outside that pending range - a row inside it is
+// indexed by the backfill with whatever values it has by then.
+void Database::addSearchIndex(){
+    auto lWhen = [](const char* pRow){ // the row is outside the range the backfill still has to do
+        return string("NOT EXISTS (SELECT 1 FROM search_index_backfill b WHERE ") + pRow + ".id BETWEEN b.next_id AND b.last_id)";
+    };
+    execute("CREATE TABLE IF NOT EXISTS search_index_backfill (next_id INTEGER NOT NULL, last_id INTEGER NOT NULL);"
+            "INSERT INTO search_index_backfill SELECT min(id), max(id) FROM users HAVING count(*) > 0;"
+            "CREATE VIRTUAL TABLE IF NOT EXISTS users_fts USING fts5(username, email, content='users', content_rowid='id', tokenize='trigram');"
+            "CREATE TRIGGER IF NOT EXISTS users_fts_insert AFTER INSERT ON users WHEN " + lWhen("new") + " BEGIN"
+            "    INSERT INTO users_fts(rowid, username, email) VALUES (new.id, new.username, new.email);"
+            " END;"
+            "CREATE TRIGGER IF NOT EXISTS users_fts_delete AFTER DELETE ON users WHEN " + lWhen("old") + " BEGIN"
+            "    INSERT INTO users_fts(users_fts, rowid, username, email) VALUES ('delete', old.id, old.username, old.email);"
+            " END;"
+            "CREATE TRIGGER IF NOT EXISTS users_fts_update AFTER UPDATE OF username, email ON users WHEN " + lWhen("old") + " BEGIN"
+            "    INSERT INTO users_fts(users_fts, rowid, username, email) VALUES ('delete', old.id, old.username, old.email);"
+            "    INSERT INTO users_fts(rowid, username, email) VALUES (new.id, new.username, new.email);"
+            " END;",
+            "creating search index");
+}
+
+/// method to store the creation time as an integer
+// created_at was DATETIME DEFAULT CURRENT_TIMESTAMP: 19 bytes of text per row, copied into a
+// string on every read, and range filters compare strings. created_at_ms is epoch milliseconds -
+// 6 bytes in SQLite's varint record format, read as a plain int64, and its index serves
+// created_after/created_before as a range scan. The API keeps showing the old text format
+// (formatted in to_json). Old rows only had second precision, they get whole seconds.
+// DROP COLUMN rewrites the table once; indexes and triggers on other columns survive it.
+// Rows inserted with no value (e.g. by the sqlite3 shell) get "now" from a trigger, like the
+// old DEFAULT CURRENT_TIMESTAMP - ADD COLUMN only allows a constant default.
+//
+// Unlike addSearchIndex this step blocks: the UPDATE, the DROP COLUMN rewrite and the index build
+// all run inside migrateSchema's single write transaction (~3s per million rows on a 1-core dev
+// box). Readers on WAL keep going; writers of other processes wait, and give up after the 5s
+// busy timeout. Not batched on purpose - DROP COLUMN rewrites the table in one statement anyway,
+// and a half-filled created_at_ms would make every range query wrong until the backfill ends.
+// --workers is safe (the parent migrates before forking); for big tables, start one instance
+// alone first so it migrates before the others take traffic.
+void Database::addCreatedAtMs(){
+    execute("ALTER TABLE users ADD COLUMN created_at_ms INTEGER NOT NULL DEFAULT 0;"
+            "UPDATE users SET created_at_ms = coalesce(CAST(strftime('%s', created_at) AS INTEGER) * 1000, 0);"
+            "ALTER TABLE users DROP COLUMN created_at;"
+            "CREATE INDEX IF NOT EXISTS users_created_at_ms ON users(created_at_ms);"
+            "CREATE TRIGGER IF NOT EXISTS users_default_created_at AFTER INSERT ON users WHEN new.created_at_ms = 0 BEGIN"
+            "    UPDATE users SET created_at_ms = CAST((julianday('now') - 2440587.5) * 86400000 AS INTEGER) WHERE id = new.id;"
+            " END;",
+            "adding created_at_ms column");
+}
+
+// Runs on its own thread and its own connection: a transaction is per connection, and the shared
+// one would pull concurrent requests into it. Every batch is one short write transaction that
+// also advances search_index_backfill, so it is crash safe and resumes where it stopped. Readers
+// are never blocked (WAL); writers wait at most one batch (a few ms), not the whole table.
+// Several processes may run it at once - each batch re-reads the position under the write lock.
+void Database::backfillSearchIndex(string pDBPath){
+    const int BATCH_ROWS = 2000;
+    auto lStart = chrono::steady_clock::now();
+    int64_t lIndexed = 0;
+
+    sqlite3* lDB = nullptr;
+    try{
+        if(sqlite3_open(pDBPath.c_str(), &lDB) != SQLITE_OK){
+            throw runtime_error("Error opening DB: " + string(sqlite3_errmsg(lDB)));
+        }
+        sqlite3_busy_timeout(lDB, 5000);
+        auto lPrepare = [&](const char* pSql){
+            sqlite3_stmt* lPreparedStmt;
+            if(sqlite3_prepare_v2(lDB, pSql, -1, &lPreparedStmt, nullptr) != SQLITE_OK){
+                throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(lDB)));
+            }
+            return unique_ptr<sqlite3_stmt, Database::StmtDeleter>(lPreparedStmt);
+        };
+        auto lExecute = [&](const char* pSql){
+            if(sqlite3_exec(lDB, pSql, nullptr, nullptr, nullptr) != SQLITE_OK){
+                throw runtime_error(string(pSql) + " " + sqlite3_errmsg(lDB));
+            }
+        };
+        auto lPosition = lPrepare("SELECT next_id, last_id FROM search_index_backfill");
+        auto lCopy = lPrepare("INSERT INTO users_fts(rowid, username, email) "
+                              "SELECT id, username, email FROM users WHERE id BETWEEN ?1 AND ?2");
+        auto lAdvance = lPrepare("UPDATE search_index_backfill SET next_id = ?1");
+        auto lFinish = lPrepare("DELETE FROM search_index_backfill");
+
+        while(!mStopSearchBackfill){
+            lExecute("BEGIN IMMEDIATE;");
+            try{
+                if(sqlite3_step(lPosition.get()) != SQLITE_ROW){
+                    sqlite3_reset(lPosition.get());
+                    lExecute("COMMIT;");
+                    mSearchIndexComplete = true;
+                    break;
+                }
+                int64_t lNext = sqlite3_column_int64(lPosition.get(), 0);
+                int64_t lLast = sqlite3_column_int64(lPosition.get(), 1);
+                int64_t lEnd = min(lNext + BATCH_ROWS - 1, lLast);
+                sqlite3_reset(lPosition.get());
+
+                sqlite3_bind_int64(lCopy.get(), 1, lNext);
+                sqlite3_bind_int64(lCopy.get(), 2, lEnd);
+                if(sqlite3_step(lCopy.get()) != SQLITE_DONE){
+                    throw runtime_error("indexing rows: " + string(sqlite3_errmsg(lDB)));
+                }
+                lIndexed += sqlite3_changes(lDB);
+                sqlite3_reset(lCopy.get());
+
+                sqlite3_stmt* lMove = (lEnd >= lLast) ? lFinish.get() : lAdvance.get();
+                if(lMove == lAdvance.get()) sqlite3_bind_int64(lMove, 1, lEnd + 1);
+                if(sqlite3_step(lMove) != SQLITE_DONE){
+                    throw runtime_error("saving backfill position: " + string(sqlite3_errmsg(lDB)));
+                }
+                sqlite3_reset(lMove);
+                lExecute("COMMIT;");
+            }
+            catch(...){
+                sqlite3_exec(lDB, "ROLLBACK;", nullptr, nullptr, nullptr);
+                throw;
+            }
+            // let waiting writers in before taking the lock again
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    catch(const exception& e){
+        LOG_ERROR(mLogger, "Search index backfill stopped: {}", e.what());
+    }
+    sqlite3_close_v2(lDB); // _v2: closes once the statements above are finalized
+
+    if(mSearchIndexComplete){
+        LOG_INFO(mLogger, "Search index backfill done: {} rows in {}ms", lIndexed,
+                 chrono::duration<double, milli>(chrono::steady_clock::now() - lStart).count());
+    }
 }
 
 
@@ -73,22 +382,14 @@ int Database::createUser(const string& pUsername, const string& pEmailId, const
         throw invalid_argument("Invalid Email Format! Required email format: *@*.*");
     }
 
-    string lQuery = "INSERT INTO users (username, email, password) VALUES (?, ?, ?);";
-    sqlite3_stmt* lPreparedStmt;
-    int rc = sqlite3_prepare_v2(mDB, lQuery.c_str(), -1, &lPreparedStmt, nullptr);
-    if(rc != SQLITE_OK){
-        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
-    }
-
-    // Using RAII - Wrapping PreparedStatement into an object that acquires the resource
-    // and guarantees destructor is called when it goes out of scope - so no need to explicitly call
-    // sqlite3_finalize()
-    // The moment a raw pointer is given to a smart pointer, consider the raw pointer invalid and 
-    // never use it again. Always interact with the resource through the smart pointer's interface (e.g., stmt.get()).
-    unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+    PhaseTimer lTimer("db-insert", &sInsertUserLatency);
+    // Using RAII - the pooled statement goes back to the pool (reset) when lStmt goes out of scope,
+    // so no need to explicitly call sqlite3_reset()/sqlite3_finalize()
+    // Always interact with the resource through the smart pointer's interface (e.g., stmt.get()).
+    PooledStmt lStmt = acquireStatement(STMT_INSERT_USER);
 
     // bind values for column data
-    rc = sqlite3_bind_text(lStmt.get(), 1, pUsername.c_str(), -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_bind_text(lStmt.get(), 1, pUsername.c_str(), -1, SQLITE_TRANSIENT);
     if(rc != SQLITE_OK){
         throw runtime_error("createUser: Error while binding data to prepared statement");
     }
@@ -102,6 +403,12 @@ int Database::createUser(const string& pUsername, const string& pEmailId, const
         throw runtime_error("createUser: Error while binding data to prepared statement");
     }
 
+    int64_t lNowMs = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    rc = sqlite3_bind_int64(lStmt.get(), 4, lNowMs);
+    if(rc != SQLITE_OK){
+        throw runtime_error("createUser: Error while binding data to prepared statement");
+    }
+
     rc = sqlite3_step(lStmt.get());
     if(rc != SQLITE_DONE){
         // error condition
@@ -113,28 +420,22 @@ int Database::createUser(const string& pUsername, const string& pEmailId, const
         }
     }
 
-    // No need of explicit call sqlite3_finalize(), unique_ptr with custom deleter will handle it
-    // sqlite3_finalize(lPreparedStmt);
+    // No need of explicit call sqlite3_reset(), the pool handle will do it
 
     // get the user id of the last inserted user
     int lUserId = sqlite3_last_insert_rowid(mDB);
+    cacheUserVersion(lUserId, 1); // a fresh row always starts at version 1
 
     return lUserId;
 }
 
 // function to get user
 optional<User> Database::getUserById(int pUserId){
-    string lQuery = "SELECT id, username, email, created_at FROM users WHERE id = ?";
-    sqlite3_stmt* lPreparedStmt;
-    int rc = sqlite3_prepare_v2(mDB, lQuery.c_str(), -1, &lPreparedStmt, nullptr);
-    if(rc != SQLITE_OK){
-        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
-    }
-
-    unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+    PhaseTimer lTimer("db-select", &sSelectUserLatency);
+    PooledStmt lStmt = acquireStatement(STMT_SELECT_USER);
 
     // Note: to access the raw pointer from a unique_ptr, you use the .get() method
-    rc = sqlite3_bind_int(lStmt.get(), 1, pUserId);
+    int rc = sqlite3_bind_int(lStmt.get(), 1, pUserId);
     if(rc != SQLITE_OK){
         throw runtime_error("getUserById: Error while binding data to prepared statement");
     }
@@ -142,25 +443,411 @@ optional<User> Database::getUserById(int pUserId){
     optional<User> lUserData = std::nullopt;
     rc = sqlite3_step(lStmt.get());
     if(rc == SQLITE_ROW){
-        int lId = sqlite3_column_int(lStmt.get(), 0);
-        string lUsername = string((const char*)sqlite3_column_text(lStmt.get(), 1));
-        string lEmailId = string((const char*)sqlite3_column_text(lStmt.get(), 2));
-        // string lPassword = string((const char*)sqlite3_column_text(lStmt.get(), 3));
-        string lCreateDate = string((const char*)sqlite3_column_text(lStmt.get(), 3));
+        lUserData = readUser(lStmt.get());
+    }
+
+    return lUserData;
+}
 
-        User lUser;
-        lUser.id = lId;
-        lUser.username = lUsername;
-        lUser.email = lEmailId;
-        lUser.created_at = lCreateDate;
 
-        lUserData = lUser;
+// function to get the current row version of a user (for ETag checks)
+// Served from mVersionCache whenever possible - no query, no row copy. The cache is only trusted
+// while "PRAGMA data_version" is unchanged: it changes when ANOTHER connection (another
+// --workers process, the sqlite3 shell, ...) commits, in which case the whole cache is dropped.
+// Our own writes don't change it, they update the cache directly.
+optional<int64_t> Database::getUserVersion(int pUserId){
+    int64_t lDataVersion = readDataVersion();
+    {
+        shared_lock<shared_mutex> lLock(mVersionCacheMtx);
+        if(lDataVersion == mCachedDataVersion){
+            auto lIt = mVersionCache.find(pUserId);
+            if(lIt != mVersionCache.end()) return lIt->second;
+        }
+    }
+    {
+        unique_lock<shared_mutex> lLock(mVersionCacheMtx);
+        if(lDataVersion != mCachedDataVersion){
+            mVersionCache.clear();
+            mCachedDataVersion = lDataVersion;
+        }
     }
 
-    return lUserData;
+    // cache miss - only the version column, served from the primary key b-tree
+    PhaseTimer lTimer("db-version", &sSelectVersionLatency);
+    PooledStmt lStmt = acquireStatement(STMT_SELECT_VERSION);
+    int rc = sqlite3_bind_int(lStmt.get(), 1, pUserId);
+    if(rc != SQLITE_OK){
+        throw runtime_error("getUserVersion: Error while binding data to prepared statement");
+    }
+    if(sqlite3_step(lStmt.get()) != SQLITE_ROW){
+        return std::nullopt;
+    }
+    int64_t lVersion = sqlite3_column_int64(lStmt.get(), 0);
+    // only cache if no other connection committed since we checked data_version - otherwise
+    // we might store a value that is already outdated
+    if(readDataVersion() == lDataVersion){
+        cacheUserVersion(pUserId, lVersion);
+    }
+    return lVersion;
 }
 
 
+User Database::readUser(sqlite3_stmt* pStmt){
+    User lUser;
+    lUser.id = sqlite3_column_int(pStmt, 0);
+    lUser.username = string((const char*)sqlite3_column_text(pStmt, 1));
+    lUser.email = string((const char*)sqlite3_column_text(pStmt, 2));
+    // string lPassword = ... - we don't want to load sensitive data into memory when it's not needed
+    lUser.created_at_ms = sqlite3_column_int64(pStmt, 3);
+    lUser.version = sqlite3_column_int64(pStmt, 4);
+    return lUser;
+}
+
+optional<User> Database::getUserByEmail(const string& pEmailId){
+    PhaseTimer lTimer("db-select", &sSelectByEmailLatency);
+    PooledStmt lStmt = acquireStatement(STMT_SELECT_USER_BY_EMAIL);
+    int rc = sqlite3_bind_text(lStmt.get(), 1, pEmailId.c_str(), (int)pEmailId.size(), SQLITE_STATIC);
+    if(rc != SQLITE_OK){
+        throw runtime_error("getUserByEmail: Error while binding data to prepared statement");
+    }
+    if(sqlite3_step(lStmt.get()) != SQLITE_ROW){
+        return std::nullopt;
+    }
+    return readUser(lStmt.get());
+}
+
+// SQLite's NOCASE: bytes compared with ASCII letters folded, then the shorter string first
+static int compareNocase(const string& pA, const string& pB){
+    size_t lLength = min(pA.size(), pB.size());
+    for(size_t i = 0; i < lLength; ++i){
+        int lA = tolower((unsigned char)pA[i]), lB = tolower((unsigned char)pB[i]);
+        if(lA != lB) return lA - lB;
+    }
+    return (int)pA.size() - (int)pB.size();
+}
+
+// Prefix match as an index range: NOCASE(username) in [prefix, prefix + 0xFF). No UTF-8 string
+// contains a 0xFF byte, so every username that starts with the prefix sorts below the upper
+// bound - and unlike LIKE 'prefix%' there is nothing to escape.
+// Keyset pagination: the range starts at the cursor's username, so page N costs the same as
+// page 1 (OFFSET would walk all the skipped rows); "> username OR id >" skips the rows of the
+// previous page that share the cursor's username.
+// The cursor comes from the client: one that sorts below the prefix must not widen the range,
+// so the lower bound is max(prefix, cursor) - one above the upper bound just finds nothing.
+vector<User> Database::findUsersByUsernamePrefix(const string& pPrefix, int pLimit, const optional<UsernameCursor>& pAfter){
+    PhaseTimer lTimer("db-select", &sSelectByUsernameLatency);
+    PooledStmt lStmt = acquireStatement(STMT_SELECT_USERS_BY_USERNAME_PREFIX);
+
+    string lUpperBound = pPrefix + '\xff';
+    bool lFromCursor = pAfter && compareNocase(pAfter->username, pPrefix) >= 0;
+    const string& lFrom = lFromCursor ? pAfter->username : pPrefix;
+    int rc = sqlite3_bind_text(lStmt.get(), 1, lFrom.c_str(), (int)lFrom.size(), SQLITE_STATIC);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int(lStmt.get(), 2, lFromCursor ? pAfter->id : 0);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_text(lStmt.get(), 3, lUpperBound.c_str(), (int)lUpperBound.size(), SQLITE_STATIC);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int(lStmt.get(), 4, pLimit);
+    if(rc != SQLITE_OK){
+        throw runtime_error("findUsersByUsernamePrefix: Error while binding data to prepared statement");
+    }
+
+    vector<User> lUsers;
+    while((rc = sqlite3_step(lStmt.get())) == SQLITE_ROW){
+        lUsers.push_back(readUser(lStmt.get()));
+    }
+    if(rc != SQLITE_DONE){
+        throw runtime_error("Error while SELECT: " + string(sqlite3_errmsg(mDB)));
+    }
+    return lUsers;
+}
+
+// Same keyset scheme as findUsersByUsernamePrefix: the range starts at max(cursor, pAfterMs + 1),
+// "> created_at_ms OR id >" skips the previous page's rows with the cursor's timestamp.
+// The index on created_at_ms is ordered by (created_at_ms, rowid) - exactly the ORDER BY.
+vector<User> Database::findUsersByCreatedAt(int64_t pAfterMs, int64_t pBeforeMs, int pLimit, const optional<CreatedAtCursor>& pAfter){
+    PhaseTimer lTimer("db-select", &sSelectByCreatedAtLatency);
+    PooledStmt lStmt = acquireStatement(STMT_SELECT_USERS_BY_CREATED_AT);
+
+    bool lFromCursor = pAfter && pAfter->createdAtMs > pAfterMs;
+    int64_t lFrom = lFromCursor ? pAfter->createdAtMs : pAfterMs + 1;
+    int rc = sqlite3_bind_int64(lStmt.get(), 1, lFrom);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int(lStmt.get(), 2, lFromCursor ? pAfter->id : 0);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int64(lStmt.get(), 3, pBeforeMs);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int(lStmt.get(), 4, pLimit);
+    if(rc != SQLITE_OK){
+        throw runtime_error("findUsersByCreatedAt: Error while binding data to prepared statement");
+    }
+
+    vector<User> lUsers;
+    while((rc = sqlite3_step(lStmt.get())) == SQLITE_ROW){
+        lUsers.push_back(readUser(lStmt.get()));
+    }
+    if(rc != SQLITE_DONE){
+        throw runtime_error("Error while SELECT: " + string(sqlite3_errmsg(mDB)));
+    }
+    return lUsers;
+}
+
+// MATCH with the query as one FTS5 string ("..." with quotes doubled): no operators or column
+// filters from user input, and with the trigram tokenizer a string matches as a substring
+vector<User> Database::searchUsers(const string& pQuery, int pLimit, int pOffset){
+    PhaseTimer lTimer("db-search", &sSearchUsersLatency);
+    PooledStmt lStmt = acquireStatement(STMT_SEARCH_USERS);
+
+    string lMatch = "\"";
+    for(char c : pQuery){
+        lMatch += c;
+        if(c == '"') lMatch += '"';
+    }
+    lMatch += '"';
+    int rc = sqlite3_bind_text(lStmt.get(), 1, lMatch.c_str(), (int)lMatch.size(), SQLITE_STATIC);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int(lStmt.get(), 2, pLimit);
+    if(rc == SQLITE_OK) rc = sqlite3_bind_int(lStmt.get(), 3, pOffset);
+    if(rc != SQLITE_OK){
+        throw runtime_error("searchUsers: Error while binding data to prepared statement");
+    }
+
+    vector<User> lUsers;
+    while((rc = sqlite3_step(lStmt.get())) == SQLITE_ROW){
+        lUsers.push_back(readUser(lStmt.get()));
+    }
+    if(rc != SQLITE_DONE){
+        throw runtime_error("Error while SELECT: " + string(sqlite3_errmsg(mDB)));
+    }
+    return lUsers;
+}
+
+bool Database::searchIndexComplete() const{
+    return mSearchIndexComplete;
+}
+
+unique_ptr<UserSnapshot> Database::openSnapshot(){
+    const char* lPath = sqlite3_db_filename(mDB, "main");
+    if(!lPath || !*lPath){
+        throw runtime_error("Snapshots need a database file"); // ":memory:" can't be opened twice
+    }
+    return make_unique<UserSnapshot>(lPath);
+}
+
+UserSnapshot::UserSnapshot(const string& pDBPath){
+    int rc = sqlite3_open_v2(pDBPath.c_str(), &mDB, SQLITE_OPEN_READONLY, nullptr);
+    if(rc != SQLITE_OK){
+        string lError = mDB ? sqlite3_errmsg(mDB) : "out of memory";
+        sqlite3_close(mDB);
+        throw runtime_error("Error opening DB: " + lError);
+    }
+    sqlite3_busy_timeout(mDB, 5000);
+    // BEGIN is deferred: the snapshot is taken by the first read and kept until COMMIT
+    rc = sqlite3_prepare_v2(mDB, "SELECT id, username, email, created_at_ms, version FROM users ORDER BY id", -1, &mStmt, nullptr);
+    if(rc == SQLITE_OK) rc = sqlite3_exec(mDB, "BEGIN;", nullptr, nullptr, nullptr);
+    if(rc != SQLITE_OK){
+        string lError = sqlite3_errmsg(mDB);
+        sqlite3_finalize(mStmt);
+        sqlite3_close(mDB);
+        throw runtime_error("Error while opening snapshot: " + lError);
+    }
+}
+
+UserSnapshot::~UserSnapshot(){
+    sqlite3_finalize(mStmt);
+    sqlite3_exec(mDB, "COMMIT;", nullptr, nullptr, nullptr); // ends the read transaction
+    sqlite3_close(mDB);
+}
+
+bool UserSnapshot::next(User& pUser){
+    if(mDone) return false;
+    int rc = sqlite3_step(mStmt);
+    if(rc != SQLITE_ROW){
+        mDone = true;
+        if(rc != SQLITE_DONE) throw runtime_error("Error while SELECT: " + string(sqlite3_errmsg(mDB)));
+        return false;
+    }
+    pUser.id = sqlite3_column_int(mStmt, 0);
+    pUser.username.assign((const char*)sqlite3_column_text(mStmt, 1), sqlite3_column_bytes(mStmt, 1));
+    pUser.email.assign((const char*)sqlite3_column_text(mStmt, 2), sqlite3_column_bytes(mStmt, 2));
+    pUser.created_at_ms = sqlite3_column_int64(mStmt, 3);
+    pUser.version = sqlite3_column_int64(mStmt, 4);
+    ++mRowsRead;
+    return true;
+}
+
+// Not pooled - it runs at startup and then only when another connection has committed.
+// A range on the primary key: catching up from the last loaded id reads only the new rows.
+int Database::forEachUsername(int pAfterId, const function<void(int, const string&)>& pFn){
+    sqlite3_stmt* lPreparedStmt;
+    int rc = sqlite3_prepare_v2(mDB, "SELECT id, username FROM users WHERE id > ? ORDER BY id", -1, &lPreparedStmt, nullptr);
+    if(rc != SQLITE_OK){
+        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+    }
+    unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+    sqlite3_bind_int(lStmt.get(), 1, pAfterId);
+
+    int lLastId = pAfterId;
+    string lUsername;
+    while((rc = sqlite3_step(lStmt.get())) == SQLITE_ROW){
+        lLastId = sqlite3_column_int(lStmt.get(), 0);
+        lUsername.assign((const char*)sqlite3_column_text(lStmt.get(), 1), sqlite3_column_bytes(lStmt.get(), 1));
+        pFn(lLastId, lUsername);
+    }
+    if(rc != SQLITE_DONE){
+        throw runtime_error("Error while SELECT: " + string(sqlite3_errmsg(mDB)));
+    }
+    return lLastId;
+}
+
+
+// function to read "PRAGMA data_version" - a counter local to this connection that changes
+// whenever another connection commits to the DB file. Cheap: no table pages are read.
+int64_t Database::readDataVersion(){
+    lock_guard<mutex> lLock(mDataVersionStmtMtx); // one prepared statement, shared by all threads
+    if(!mDataVersionStmt){
+        sqlite3_stmt* lPreparedStmt;
+        int rc = sqlite3_prepare_v2(mDB, "PRAGMA data_version", -1, &lPreparedStmt, nullptr);
+        if(rc != SQLITE_OK){
+            throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+        }
+        mDataVersionStmt.reset(lPreparedStmt);
+    }
+    int64_t lDataVersion = -1;
+    if(sqlite3_step(mDataVersionStmt.get()) == SQLITE_ROW){
+        lDataVersion = sqlite3_column_int64(mDataVersionStmt.get(), 0);
+    }
+    sqlite3_reset(mDataVersionStmt.get());
+    return lDataVersion;
+}
+
+void Database::cacheUserVersion(int pUserId, int64_t pVersion){
+    unique_lock<shared_mutex> lLock(mVersionCacheMtx);
+    // keep memory bounded - ids are cheap to re-read, so simply start over
+    if(mVersionCache.size() >= MAX_CACHED_VERSIONS) mVersionCache.clear();
+    mVersionCache[pUserId] = pVersion;
+}
+
+// SQL of the pooled statements, indexed by StatementId
+const char* const Database::sStatementSql[STMT_COUNT] = {
+    "INSERT INTO users (username, email, password, created_at_ms) VALUES (?, ?, ?, ?);", // STMT_INSERT_USER
+    "SELECT id, username, email, created_at_ms, version FROM users WHERE id = ?", // STMT_SELECT_USER
+    "SELECT version FROM users WHERE id = ?",                            // STMT_SELECT_VERSION
+    "SELECT id, username, email, created_at_ms, version FROM users WHERE email = ?", // STMT_SELECT_USER_BY_EMAIL
+    "SELECT id, username, email, created_at_ms, version FROM users "        // STMT_SELECT_USERS_BY_USERNAME_PREFIX
+        "WHERE username >= ?1 COLLATE NOCASE AND username < ?3 COLLATE NOCASE "
+        "AND (username > ?1 COLLATE NOCASE OR id > ?2) "
+        "ORDER BY username COLLATE NOCASE, id LIMIT ?4",
+    "SELECT users.id, users.username, users.email, users.created_at_ms, users.version " // STMT_SEARCH_USERS
+        "FROM users_fts JOIN users ON users.id = users_fts.rowid WHERE users_fts MATCH ?1 "
+        "ORDER BY bm25(users_fts, 2.0, 1.0), users.id LIMIT ?2 OFFSET ?3",
+    "SELECT id, username, email, created_at_ms, version FROM users "      // STMT_SELECT_USERS_BY_CREATED_AT
+        "WHERE created_at_ms >= ?1 AND created_at_ms < ?3 AND (created_at_ms > ?1 OR id > ?2) "
+        "ORDER BY created_at_ms, id LIMIT ?4",
+};
+
+Database::PooledStmt Database::acquireStatement(StatementId pId){
+    StatementSlot& lSlot = mStatementPool[pId];
+    {
+        lock_guard<mutex> lLock(lSlot.mtx);
+        if(!lSlot.idle.empty()){
+            sqlite3_stmt* lStmt = lSlot.idle.back();
+            lSlot.idle.pop_back();
+            return PooledStmt(lStmt, StmtReturner{this, pId});
+        }
+    }
+    // pool empty (first use, or more threads than idle statements): prepare one more.
+    // PERSISTENT tells SQLite the statement lives long, so it's allocated outside the lookaside pool.
+    sqlite3_stmt* lPreparedStmt;
+    int rc = sqlite3_prepare_v3(mDB, sStatementSql[pId], -1, SQLITE_PREPARE_PERSISTENT, &lPreparedStmt, nullptr);
+    if(rc != SQLITE_OK){
+        throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+    }
+    return PooledStmt(lPreparedStmt, StmtReturner{this, pId});
+}
+
+void Database::StmtReturner::operator()(sqlite3_stmt* stmt) const{
+    if(!stmt) return;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt); // don't keep the last caller's strings alive
+    StatementSlot& lSlot = db->mStatementPool[id];
+    lock_guard<mutex> lLock(lSlot.mtx);
+    lSlot.idle.push_back(stmt);
+}
+
+int64_t Database::prewarm(){
+    auto lStart = chrono::steady_clock::now();
+
+    // 1. every statement prepared once - the first requests don't pay for parsing/planning
+    for(int i = 0; i < STMT_COUNT; ++i){
+        acquireStatement((StatementId)i); // back into the pool right away
+    }
+
+    // 2. read every table and index once. A full scan of a table walks all its pages (overflow
+    //    pages included); count(*) forced onto an index walks the whole index b-tree.
+    vector<pair<string, string>> lObjects; // type, "SELECT ..." that reads it
+    {
+        sqlite3_stmt* lPreparedStmt;
+        int rc = sqlite3_prepare_v2(mDB, "SELECT type, name, tbl_name FROM sqlite_master "
+                                         "WHERE type IN ('table', 'index') AND name NOT LIKE 'sqlite_stat%'",
+                                    -1, &lPreparedStmt, nullptr);
+        if(rc != SQLITE_OK){
+            throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+        }
+        unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+        while(sqlite3_step(lStmt.get()) == SQLITE_ROW){
+            string lType = (const char*)sqlite3_column_text(lStmt.get(), 0);
+            string lName = (const char*)sqlite3_column_text(lStmt.get(), 1);
+            string lTable = (const char*)sqlite3_column_text(lStmt.get(), 2);
+            if(lType == "table") lObjects.emplace_back(lType, "SELECT * FROM \"" + lName + "\"");
+            else lObjects.emplace_back(lType, "SELECT count(*) FROM \"" + lTable + "\" INDEXED BY \"" + lName + "\"");
+        }
+    }
+    int64_t lRead = 0;
+    for(const auto& [lType, lQuery] : lObjects){
+        sqlite3_stmt* lPreparedStmt;
+        if(sqlite3_prepare_v2(mDB, lQuery.c_str(), -1, &lPreparedStmt, nullptr) != SQLITE_OK){
+            // e.g. virtual tables that can't be scanned like this - warming is best effort
+            LOG_DEBUG(mLogger, "Prewarm skipped: {} ({})", lQuery, sqlite3_errmsg(mDB));
+            continue;
+        }
+        unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+        while(sqlite3_step(lStmt.get()) == SQLITE_ROW){
+            lRead += (lType == "table") ? 1 : sqlite3_column_int64(lStmt.get(), 0);
+        }
+    }
+
+    // 3. row versions, so conditional GETs are answered from memory from the first request on
+    size_t lVersionCount = 0;
+    {
+        int64_t lDataVersion = readDataVersion();
+        sqlite3_stmt* lPreparedStmt;
+        int rc = sqlite3_prepare_v2(mDB, "SELECT id, version FROM users ORDER BY id DESC LIMIT ?", -1, &lPreparedStmt, nullptr);
+        if(rc != SQLITE_OK){
+            throw runtime_error("Error while creating PreparedStatement: " + string(sqlite3_errmsg(mDB)));
+        }
+        unique_ptr<sqlite3_stmt, Database::StmtDeleter> lStmt(lPreparedStmt);
+        sqlite3_bind_int64(lStmt.get(), 1, (int64_t)MAX_CACHED_VERSIONS);
+        // filled without the lock - with --prewarm background, conditional GETs keep using the
+        // cache while this scans up to MAX_CACHED_VERSIONS rows
+        unordered_map<int, int64_t> lVersions;
+        lVersions.reserve(MAX_CACHED_VERSIONS);
+        while(sqlite3_step(lStmt.get()) == SQLITE_ROW){
+            lVersions[sqlite3_column_int(lStmt.get(), 0)] = sqlite3_column_int64(lStmt.get(), 1);
+        }
+
+        // another connection committed during the scan: it may be stale, leave the cache alone
+        if(readDataVersion() == lDataVersion){
+            unique_lock<shared_mutex> lLock(mVersionCacheMtx);
+            if(mCachedDataVersion == lDataVersion){
+                // cached during the scan (our own writes, fresh reads) - at least as new
+                for(const auto& [lId, lVersion] : mVersionCache) lVersions[lId] = lVersion;
+            }
+            mVersionCache.swap(lVersions);
+            mCachedDataVersion = lDataVersion;
+            lVersionCount = mVersionCache.size();
+        }
+    } // the old entries are freed here, outside the lock
+
+    LOG_INFO(mLogger, "Prewarm done: {} statements, {} tables/indexes ({} rows/entries), {} row versions in {}ms",
+             (int)STMT_COUNT, lObjects.size(), lRead, lVersionCount,
+             chrono::duration<double, milli>(chrono::steady_clock::now() - lStart).count());
+    return lRead;
+}
+
 /////////////////// Helper Functions /////////////////////
 // function to validate email address format
 bool Database::isValidEmail(const string& pEmailId){
@@ -1,7 +1,15 @@
 #include <iostream>
 #include <stdexcept>
 #include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>    // rename
+#include <fcntl.h>   // open, fallocate
+#include <unistd.h>  // write, close
+#include <sys/stat.h>
+#include <zlib.h>    // gzip for rotated segments
 #include "Logger.h"
+#include "Metrics.h"
 
 using namespace std;
 
@@ -9,11 +17,29 @@ using namespace std;
 shared_ptr<FileLogger> FileLogger::mInstance = nullptr;
 mutex FileLogger::sObjMutex;;
 
+static ShardedCounter& sDroppedRecords = MetricsRegistry::getInstance().counter(
+    "user_service_log_records_dropped_total", "Log records discarded because the async log ring was full");
+static ShardedCounter& sRotations = MetricsRegistry::getInstance().counter(
+    "user_service_log_rotations_total", "Log file segments rotated");
+
 ILogger::~ILogger(){
 
 }
 
+int64_t ILogger::unixMicros(){
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+string& ILogger::formatBuffer(){
+    thread_local string tBuffer;
+    return tBuffer;
+}
+
 string ILogger::LogLevelToString(LOG_LEVEL pLogLevel){
+    return levelName(pLogLevel);
+}
+
+const char* ILogger::levelName(LOG_LEVEL pLogLevel){
     switch(pLogLevel){
         case ERROR: return "ERROR";
         case WARNING: return "WARNING";
@@ -24,20 +50,77 @@ string ILogger::LogLevelToString(LOG_LEVEL pLogLevel){
     return "";
 }
 
+// Per-thread cache of the formatted timestamp "2026-10-19T09:57:12.123Z".
+// gmtime_r + strftime (the expensive part) run only when the second changes, i.e. at most once
+// per second per thread; within the same second only the 3 millisecond digits are rewritten,
+// and only when the millisecond changed. Thread-local, so no locking (ctime() used a shared
+// static buffer and wasn't thread-safe).
+struct TimestampCache{
+    int64_t second = -1;
+    int millis = -1;
+    char text[32] = {};
+    size_t length = 0;
+};
+
+static void appendTimestamp(string& pOut){
+    thread_local TimestampCache tCache;
+    int64_t lNowMillis = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    int64_t lSecond = lNowMillis / 1000;
+    int lMillis = (int)(lNowMillis % 1000);
+
+    if(lSecond != tCache.second){
+        time_t lTime = (time_t)lSecond;
+        tm lTm;
+        gmtime_r(&lTime, &lTm);
+        size_t lLength = strftime(tCache.text, sizeof(tCache.text), "%Y-%m-%dT%H:%M:%S", &lTm);
+        memcpy(tCache.text + lLength, ".000Z", 5);
+        tCache.length = lLength + 5;
+        tCache.second = lSecond;
+        tCache.millis = -1;
+    }
+    if(lMillis != tCache.millis){
+        char* lDigits = tCache.text + tCache.length - 4; // after the '.'
+        lDigits[0] = (char)('0' + lMillis / 100);
+        lDigits[1] = (char)('0' + lMillis / 10 % 10);
+        lDigits[2] = (char)('0' + lMillis % 10);
+        tCache.millis = lMillis;
+    }
+    pOut.append(tCache.text, tCache.length);
+}
+
 // Constructor
 FileLogger::FileLogger(string& pLogFilePath){
-    mLogFile.open(pLogFilePath.c_str());
-    if(!mLogFile.is_open()){
+    mLogPath = pLogFilePath;
+    mLogFd = open(pLogFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(mLogFd < 0){
         throw runtime_error("Error while opening log file.");
     }
-    mLogFile<<"Logging started."<<endl;
-    mLogLevel = LOG_LEVEL::ERROR;
+    string lStarted = "Logging started.\n";
+    writeAll(lStarted.data(), lStarted.size());
+    setLogLevel(LOG_LEVEL::ERROR);
 }
 
 // Destructor
 FileLogger::~FileLogger(){
-    if(mLogFile.is_open())
-        mLogFile.close();
+    if(isBinary()) LogFormatRegistry::getInstance().detachSink();
+    disableAsync(); // flush-on-shutdown: every queued record reaches the file
+
+    if(mRotationThread.joinable()){
+        {
+            lock_guard<mutex> lock(mRotationMtx);
+            mStopRotation = true;
+        }
+        mRotationWakeup.notify_one();
+        mRotationThread.join(); // finishes pending renames/compression first
+        int lNextFd = mNextFd.exchange(-1);
+        if(lNextFd >= 0){
+            close(lNextFd);
+            unlink(pendingSegmentPath().c_str());
+        }
+    }
+    if(mLogFd >= 0)
+        close(mLogFd);
 }
 
 shared_ptr<FileLogger> FileLogger::getInstance(string& pLogFilePath){
@@ -54,23 +137,306 @@ shared_ptr<FileLogger> FileLogger::getInstance(string& pLogFilePath){
     return FileLogger::mInstance;
 }
 
-void FileLogger::setLogLevel(LOG_LEVEL pLogLevel){
-    mLogLevel = pLogLevel;
+// Builds the whole line into pOut (appends, no temporaries)
+void FileLogger::formatLine(string& pOut, const string& pLogMsg, LOG_LEVEL pLogLevel) const{
+    pOut += " [";
+    appendTimestamp(pOut);
+    if(mMonotonicOffsets.load(memory_order_relaxed)){
+        int64_t lMicros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - mStartTime).count();
+        char lOffset[32];
+        int lLength = snprintf(lOffset, sizeof(lOffset), " +%lld.%06lld", (long long)(lMicros / 1000000), (long long)(lMicros % 1000000));
+        pOut.append(lOffset, lLength);
+    }
+    pOut += "] [";
+    pOut += levelName(pLogLevel);
+    pOut += "]: ";
+    pOut += pLogMsg;
+    pOut += '\n';
 }
 
 // log() to log message
 void FileLogger::log(const string& pLogMsg, LOG_LEVEL pLogLevel){
-    if(pLogLevel <= mLogLevel){
-        // Get the current calendar time as a time_t object
-        time_t now = time(0); 
-    
-        // Convert to a human-readable string using ctime()
-        string date_time = string(ctime(&now));
-        date_time.pop_back(); // remove new-line character(\n) inserted by ctime()
-    
-        lock_guard<mutex> lock(mFileMtx); // for thread safety
-        string pLog = " [" + string(date_time) + "] [" + LogLevelToString(pLogLevel) + "]: " + pLogMsg;
-        // mLogFile<<string(date_time)<<" ["<<LogLevelToString(pLogLevel)<<"]: "<<pLogMsg<<endl;
-        mLogFile << pLog.c_str() << endl;
+    if(isEnabled(pLogLevel)){
+        // one per thread, keeps its capacity - a line costs no allocation once warmed up
+        thread_local string tLine;
+        tLine.clear();
+        if(isBinary()){
+            binlog::appendTextRecord(tLine, pLogLevel, unixMicros(), pLogMsg);
+        }
+        else{
+            formatLine(tLine, pLogMsg, pLogLevel);
+        }
+        writeRecord(tLine);
+    }
+}
+
+void FileLogger::logBinaryRecord(const string& pRecord){
+    writeRecord(pRecord);
+}
+
+void FileLogger::writeRecord(const string& pRecord, bool pNeverDrop){
+    if(mAsync.load(memory_order_acquire)){
+        // counted before mAsync is read again, so disableAsync() can wait for every producer that
+        // may still push into the ring (seq_cst on both sides: either we see mAsync == false, or
+        // disableAsync() sees us in our shard)
+        atomic<int>& lProducers = mAsyncProducers[metricShardIndex()].count;
+        lProducers.fetch_add(1);
+        if(mAsync.load()){
+            enqueue(pRecord, pNeverDrop); // formatted here, written by the writer thread
+            lProducers.fetch_sub(1, memory_order_release);
+            return;
+        }
+        lProducers.fetch_sub(1, memory_order_release); // disabled meanwhile - write it ourselves
+    }
+    lock_guard<mutex> lock(mFileMtx); // for thread safety
+    writeAll(pRecord.data(), pRecord.size());
+}
+
+// Not safe against other threads logging at the same moment (a text line could land after the
+// header) - it's meant for startup, before the server accepts requests.
+void FileLogger::enableBinary(){
+    if(isBinary()) return;
+    string lHeader;
+    binlog::appendHeader(lHeader);
+    writeRecord(lHeader, true);
+    // writes the definitions registered so far now, and every later one as it is registered
+    // (always before the first record using it - registration happens before that log call)
+    LogFormatRegistry::getInstance().attachSink([this](const string& pRecord){
+        writeRecord(pRecord, true);
+    });
+    mBinary.store(true, memory_order_relaxed);
+}
+
+void FileLogger::writeAll(const char* pData, size_t pLength){
+    writeFd(mLogFd.load(memory_order_acquire), pData, pLength);
+    if(mRotationEnabled.load(memory_order_relaxed)){
+        mSegmentBytes.fetch_add(pLength, memory_order_relaxed);
+        maybeRotate();
+    }
+}
+
+// write() may write less than asked (or be interrupted) - loop until everything is out
+void FileLogger::writeFd(int pFd, const char* pData, size_t pLength){
+    while(pLength > 0){
+        ssize_t lWritten = ::write(pFd, pData, pLength);
+        if(lWritten < 0){
+            if(errno == EINTR) continue;
+            cerr<<"FileLogger: write failed: "<<strerror(errno)<<endl;
+            return;
+        }
+        pData += lWritten;
+        pLength -= (size_t)lWritten;
+    }
+}
+
+///////////////////////// rotation /////////////////////////
+void FileLogger::enableRotation(const LogRotationPolicy& pPolicy){
+    if(mRotationEnabled.load()) return;
+    if(pPolicy.maxBytes == 0 && pPolicy.interval.count() <= 0){
+        throw invalid_argument("log rotation needs a size and/or an interval");
+    }
+    mRotationPolicy = pPolicy;
+
+    struct stat lStat;
+    mSegmentBytes = (fstat(mLogFd, &lStat) == 0) ? (uint64_t)lStat.st_size : 0;
+    if(mRotationPolicy.interval.count() > 0){
+        mSegmentDeadline = (chrono::steady_clock::now() + mRotationPolicy.interval).time_since_epoch().count();
+    }
+    prepareNextSegment(); // the first one synchronously, later ones in the background
+    mRotationThread = thread(&FileLogger::rotationLoop, this);
+    mRotationEnabled.store(true);
+}
+
+// Called after every write. Cheap unless a limit is hit: two relaxed loads and a compare.
+void FileLogger::maybeRotate(){
+    bool lTooBig = mRotationPolicy.maxBytes > 0 && mSegmentBytes.load(memory_order_relaxed) >= mRotationPolicy.maxBytes;
+    int64_t lDeadline = mSegmentDeadline.load(memory_order_relaxed);
+    bool lTooOld = lDeadline > 0 && chrono::steady_clock::now().time_since_epoch().count() >= lDeadline;
+    if(!lTooBig && !lTooOld) return;
+
+    if(mRotating.exchange(true, memory_order_acquire)) return; // another thread is on it
+    // no prepared segment yet (the background thread is still busy with the previous rotation):
+    // keep writing to the current one, try again on the next write
+    int lNextFd = mNextFd.exchange(-1);
+    if(lNextFd >= 0){
+        if(isBinary()){
+            // every binary segment must be decodable on its own
+            string lPreamble;
+            LogFormatRegistry::getInstance().appendPreamble(lPreamble);
+            writeFd(lNextFd, lPreamble.data(), lPreamble.size());
+        }
+        int lOldFd = mLogFd.exchange(lNextFd, memory_order_acq_rel);
+        mSegmentBytes.store(0, memory_order_relaxed);
+        if(mRotationPolicy.interval.count() > 0){
+            mSegmentDeadline.store((chrono::steady_clock::now() + mRotationPolicy.interval).time_since_epoch().count(),
+                                   memory_order_relaxed);
+        }
+        {
+            lock_guard<mutex> lock(mRotationMtx);
+            mRetiredFds.push_back(lOldFd);
+        }
+        mRotationWakeup.notify_one();
+        sRotations.add();
+    }
+    mRotating.store(false, memory_order_release);
+}
+
+// Creates "<path>.next" and reserves maxBytes of disk for it. FALLOC_FL_KEEP_SIZE: the blocks
+// are allocated but the file size stays 0, so O_APPEND writes still start at the beginning.
+void FileLogger::prepareNextSegment(){
+    string lPath = pendingSegmentPath();
+    int lFd = open(lPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if(lFd < 0){
+        cerr<<"FileLogger: can't create "<<lPath<<": "<<strerror(errno)<<endl;
+        return;
+    }
+#ifdef __linux__
+    if(mRotationPolicy.maxBytes > 0){
+        fallocate(lFd, FALLOC_FL_KEEP_SIZE, 0, (off_t)mRotationPolicy.maxBytes); // best effort
+    }
+#endif
+    mNextFd.store(lFd, memory_order_release);
+}
+
+static bool gzipFile(const string& pSource, const string& pTarget){
+    FILE* lIn = fopen(pSource.c_str(), "rb");
+    if(!lIn) return false;
+    gzFile lOut = gzopen(pTarget.c_str(), "wb6");
+    if(!lOut){
+        fclose(lIn);
+        return false;
+    }
+    char lBuffer[64 * 1024];
+    size_t lRead;
+    bool lOk = true;
+    while((lRead = fread(lBuffer, 1, sizeof(lBuffer), lIn)) > 0){
+        if(gzwrite(lOut, lBuffer, (unsigned)lRead) != (int)lRead){
+            lOk = false;
+            break;
+        }
+    }
+    fclose(lIn);
+    if(gzclose(lOut) != Z_OK) lOk = false;
+    return lOk;
+}
+
+// Background half of a rotation, one retired segment at a time (in order)
+void FileLogger::rotationLoop(){
+    for(;;){
+        int lRetiredFd;
+        {
+            unique_lock<mutex> lLock(mRotationMtx);
+            mRotationWakeup.wait(lLock, [this]{ return mStopRotation || !mRetiredFds.empty(); });
+            if(mRetiredFds.empty()) return; // stopping, nothing left to do
+            lRetiredFd = mRetiredFds.front();
+            mRetiredFds.erase(mRetiredFds.begin());
+        }
+
+        // give back the preallocated blocks the segment didn't use, then close it. Nobody writes
+        // to it anymore: writes are serialized (mFileMtx, or the single async writer) and the
+        // swap happened on that same write path.
+        struct stat lStat;
+        if(fstat(lRetiredFd, &lStat) == 0 && ftruncate(lRetiredFd, lStat.st_size) != 0){
+            cerr<<"FileLogger: ftruncate failed: "<<strerror(errno)<<endl;
+        }
+        close(lRetiredFd);
+
+        string lSegment = mLogPath + "." + to_string(++mSegmentSequence);
+        rename(mLogPath.c_str(), lSegment.c_str());
+        rename(pendingSegmentPath().c_str(), mLogPath.c_str());
+        prepareNextSegment();
+
+        if(mRotationPolicy.compress){
+            if(gzipFile(lSegment, lSegment + ".gz")) unlink(lSegment.c_str());
+            else cerr<<"FileLogger: failed to compress "<<lSegment<<endl;
+        }
+        if(mRotationPolicy.keepSegments > 0 && mSegmentSequence > (uint64_t)mRotationPolicy.keepSegments){
+            string lExpired = mLogPath + "." + to_string(mSegmentSequence - mRotationPolicy.keepSegments);
+            unlink(lExpired.c_str());
+            unlink((lExpired + ".gz").c_str());
+        }
+    }
+}
+
+///////////////////////// async mode /////////////////////////
+void FileLogger::enableAsync(size_t pCapacity, LogOverflowPolicy pPolicy){
+    lock_guard<mutex> lock(mFileMtx);
+    if(mAsync.load()) return;
+    // Allocated by the first call and never replaced - pCapacity of a later call is ignored.
+    // Replacing it would free a ring a late producer may still be pushing into.
+    if(!mRing){
+        mRing = make_unique<MpscRing>(pCapacity);
+    }
+    mOverflowPolicy = pPolicy;
+    mStopWriter = false;
+    mWriterThread = thread(&FileLogger::writerLoop, this);
+    mAsync.store(true, memory_order_release);
+}
+
+void FileLogger::disableAsync(){
+    lock_guard<mutex> lock(mFileMtx);
+    if(!mAsync.load()) return;
+    mAsync.store(false); // new records go straight to the file again
+
+    // Producers that saw mAsync == true may still be pushing. Wait for them while the writer
+    // keeps draining - under BLOCK they can only finish once it has freed a cell.
+    for(ProducerShard& lShard : mAsyncProducers){
+        while(lShard.count.load() != 0){
+            mWriterWakeup.notify_one();
+            this_thread::yield();
+        }
+    }
+
+    mStopWriter = true;
+    mWriterWakeup.notify_one();
+    mWriterThread.join(); // the writer drains the ring before it exits - nobody pushes anymore
+}
+
+uint64_t FileLogger::droppedRecords() const{
+    return sDroppedRecords.value();
+}
+
+void FileLogger::enqueue(const string& pLine, bool pNeverDrop){
+    while(!mRing->tryPush(pLine.data(), pLine.size())){
+        if(mOverflowPolicy == LogOverflowPolicy::DROP && !pNeverDrop){
+            sDroppedRecords.add();
+            return;
+        }
+        // BLOCK: make sure the writer is awake, then give it time to free a cell
+        mWriterWakeup.notify_one();
+        this_thread::yield();
+    }
+    // Wake the writer only if it's sleeping - the common case is a plain atomic load.
+    // notify_one() without holding mWriterMtx can race with the writer going to sleep; the
+    // writer's sleep has a short timeout, so such a record is delayed by at most that long.
+    if(mWriterIdle.load(memory_order_relaxed)){
+        mWriterWakeup.notify_one();
+    }
+}
+
+// Single consumer of the ring: collects records into one buffer and writes it with a single
+// write() once it's large (WRITE_BATCH_BYTES) or the ring is empty.
+void FileLogger::writerLoop(){
+    string lBatch;
+    lBatch.reserve(WRITE_BATCH_BYTES * 2);
+
+    for(;;){
+        while(lBatch.size() < WRITE_BATCH_BYTES && mRing->tryPopInto(lBatch)) {}
+        if(!lBatch.empty()){
+            writeAll(lBatch.data(), lBatch.size());
+            lBatch.clear();
+            continue;
+        }
+        // ring is empty here - exit only now, so nothing queued is left behind
+        if(mStopWriter.load()) break;
+
+        mWriterIdle.store(true);
+        {
+            unique_lock<mutex> lLock(mWriterMtx);
+            if(mRing->empty() && !mStopWriter.load()){
+                mWriterWakeup.wait_for(lLock, chrono::milliseconds(10));
+            }
+        }
+        mWriterIdle.store(false);
     }
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "MpscRing.h"
+
+using namespace std;
+
+MpscRing::MpscRing(size_t pCapacity){
+    size_t lCapacity = 2;
+    while(lCapacity < pCapacity) lCapacity <<= 1;
+    mMask = lCapacity - 1;
+    mCells.reset(new Cell[lCapacity]);
+    for(size_t i = 0; i < lCapacity; ++i){
+        // cell i is free for the producer that claims position i
+        mCells[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+bool MpscRing::tryPush(const char* pData, size_t pLength){
+    size_t lPos = mEnqueuePos.load(memory_order_relaxed);
+    for(;;){
+        Cell& lCell = mCells[lPos & mMask];
+        size_t lSequence = lCell.sequence.load(memory_order_acquire);
+        intptr_t lDiff = (intptr_t)lSequence - (intptr_t)lPos;
+
+        if(lDiff == 0){
+            // cell is free for position lPos - try to claim it
+            if(mEnqueuePos.compare_exchange_weak(lPos, lPos + 1, memory_order_relaxed)){
+                lCell.data.assign(pData, pLength);
+                lCell.sequence.store(lPos + 1, memory_order_release); // publish to the consumer
+                return true;
+            }
+            // CAS failed: lPos was reloaded with the current tail, retry
+        }
+        else if(lDiff < 0){
+            return false; // the consumer hasn't freed this cell yet - ring is full
+        }
+        else{
+            lPos = mEnqueuePos.load(memory_order_relaxed); // another producer got it, catch up
+        }
+    }
+}
+
+bool MpscRing::tryPopInto(string& pOut){
+    Cell& lCell = mCells[mDequeuePos & mMask];
+    size_t lSequence = lCell.sequence.load(memory_order_acquire);
+    if(lSequence != mDequeuePos + 1){
+        return false; // not published yet
+    }
+    pOut.append(lCell.data);
+    // hand the cell back to producers, one lap ahead
+    lCell.sequence.store(mDequeuePos + mMask + 1, memory_order_release);
+    ++mDequeuePos;
+    return true;
+}
+
+bool MpscRing::empty() const{
+    const Cell& lCell = mCells[mDequeuePos & mMask];
+    return lCell.sequence.load(memory_order_acquire) != mDequeuePos + 1;
+}
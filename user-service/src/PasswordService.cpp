@@ -5,9 +5,18 @@
 #include <random>
 #include "argon2.h" // Note double quotes, not angle braces
 #include "PasswordService.h"
+#include "Metrics.h"
+#include "RequestContext.h"
 
 using namespace std;
 
+// Argon2 is deliberately expensive (~64 MiB, tens of ms) - worth watching on /metrics.
+// The histogram's _count is the number of hashes/verifications.
+static LatencyHistogram& sHashLatency = MetricsRegistry::getInstance().histogram(
+    "user_service_argon2_duration_seconds", "Time spent in Argon2 hashing/verification", "op=\"hash\"");
+static LatencyHistogram& sVerifyLatency = MetricsRegistry::getInstance().histogram(
+    "user_service_argon2_duration_seconds", "Time spent in Argon2 hashing/verification", "op=\"verify\"");
+
 
 // Takes a plaintext password and produce a secure, encoded hash string to store in the DB
 // The encoded hash conveniently contains the salt, the parameters, and the final hash all in one string.
@@ -49,6 +58,7 @@ string PasswordService::hashPassword(string& pPassword){
     vector<char> encoded(encoded_len);
 
     // 4. Call the hashing function
+    PhaseTimer lTimer("argon2", &sHashLatency);
     int result = argon2id_hash_encoded(
         t_cost, m_cost, parallelism,
         pPassword.c_str(), pPassword.length(),
@@ -70,6 +80,7 @@ string PasswordService::hashPassword(string& pPassword){
 // The argon2id_verify function does all the hard work of extracting the salt and parameters from the hash string for you.
 bool PasswordService::verifyPassword(const string& pPassword, const string& pHashedPassword) {
     // Call the verify function. It returns ARGON2_OK on success.
+    PhaseTimer lTimer("argon2-verify", &sVerifyLatency);
     int lRes = argon2id_verify(
         pHashedPassword.c_str(),  // The encoded hash from the database
         pPassword.c_str(),        // The plaintext password to check
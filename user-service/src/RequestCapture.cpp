@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include "RequestCapture.h"
+#include "../libs/argon2/src/blake2/blake2.h" // the vendored argon2's BLAKE2b, already linked in
+
+using namespace std;
+using json = nlohmann::json;
+
+// headers that change the answer - everything else (auth, cookies, user agents) stays out
+static const char* sCapturedHeaders[] = {"Content-Type", "Accept", "If-None-Match", "grpc-timeout"};
+
+// query parameters that carry personal data (GET /users lookups, /users/suggest, /users/search)
+static const char* sPersonalParams[] = {"email", "username", "username_prefix", "q"};
+// ...and the ones matched as a prefix/substring, where a pseudonym finds nothing on replay
+static const char* sPartialMatchParams[] = {"username_prefix", "q"};
+
+RequestCapture::RequestCapture(const string& pPath, const string& pPseudonymKey)
+    : mPseudonymKey(pPseudonymKey.empty() ? newPseudonymKey() : pPseudonymKey){
+    mOut.open(pPath, ios::out | ios::app);
+    if(!mOut){
+        throw runtime_error("Cannot open capture file: " + pPath);
+    }
+}
+
+string RequestCapture::newPseudonymKey(){
+    random_device lRandom; // /dev/urandom
+    string lKey;
+    for(int i = 0; i < 8; ++i){
+        uint32_t lWord = lRandom();
+        lKey.append((const char*)&lWord, sizeof(lWord));
+    }
+    return lKey;
+}
+
+string RequestCapture::pseudonym(const string& pValue, bool pEmail) const{
+    static const char* sHex = "0123456789abcdef";
+    uint8_t lHash[8];
+    blake2b(lHash, sizeof(lHash), pValue.data(), pValue.size(), mPseudonymKey.data(), mPseudonymKey.size());
+    string lPseudonym = "u";
+    for(uint8_t b : lHash){
+        lPseudonym += sHex[b >> 4];
+        lPseudonym += sHex[b & 0xF];
+    }
+    return pEmail ? lPseudonym + "@example.invalid" : lPseudonym;
+}
+
+// Username lookup cursors are "<hex of the username>.<id>" (UserService::encodeCursor) - the
+// username in them gets the same pseudonym, so paging through a replayed lookup still works.
+// Anything that doesn't parse was a 400 at capture time and stays one.
+string RequestCapture::pseudonymizeCursor(const string& pCursor) const{
+    static const char* sHex = "0123456789abcdef";
+    size_t lDot = pCursor.find('.');
+    if(lDot == string::npos || lDot % 2 != 0 || pCursor.find_first_not_of(sHex) != lDot){
+        return pseudonym(pCursor, false);
+    }
+    string lUsername;
+    for(size_t i = 0; i < lDot; i += 2){
+        lUsername += (char)stoi(pCursor.substr(i, 2), nullptr, 16);
+    }
+    string lCursor;
+    for(unsigned char c : pseudonym(lUsername, false)){
+        lCursor += sHex[c >> 4];
+        lCursor += sHex[c & 0xF];
+    }
+    return lCursor + pCursor.substr(lDot);
+}
+
+string RequestCapture::pseudonymizeTarget(const string& pTarget) const{
+    size_t lQuery = pTarget.find('?');
+    if(lQuery == string::npos) return pTarget;
+
+    vector<pair<string, string>> lParams; // name, raw value (npos '=' -> no value)
+    bool lUsernameCursor = false;
+    size_t lPos = lQuery + 1;
+    while(lPos <= pTarget.size()){
+        size_t lEnd = pTarget.find('&', lPos);
+        if(lEnd == string::npos) lEnd = pTarget.size();
+        string lParam = pTarget.substr(lPos, lEnd - lPos);
+        size_t lEquals = lParam.find('=');
+        lParams.emplace_back(lParam.substr(0, lEquals), lEquals == string::npos ? string() : lParam.substr(lEquals));
+        if(lParams.back().first == "username_prefix") lUsernameCursor = true;
+        lPos = lEnd + 1;
+    }
+
+    string lTarget = pTarget.substr(0, lQuery + 1);
+    for(size_t i = 0; i < lParams.size(); ++i){
+        const string& lName = lParams[i].first;
+        string lValue = lParams[i].second; // "=..." or empty
+        if(!lValue.empty()){
+            // decoded first: "bob%40x.io" in a query and "bob@x.io" in a body get one pseudonym
+            string lDecoded = httplib::detail::decode_path(lValue.substr(1), true);
+            if(any_of(begin(sPersonalParams), end(sPersonalParams), [&](const char* p){ return lName == p; })){
+                lValue = "=" + pseudonym(lDecoded, lName == "email");
+            }
+            else if(lName == "cursor" && lUsernameCursor){
+                lValue = "=" + pseudonymizeCursor(lDecoded);
+            }
+        }
+        if(i > 0) lTarget += '&';
+        lTarget += lName + lValue;
+    }
+    return lTarget;
+}
+
+bool RequestCapture::replayFaithful(const string& pTarget){
+    size_t lPos = pTarget.find('?');
+    while(lPos != string::npos){
+        size_t lEnd = pTarget.find_first_of("=&", lPos + 1);
+        string lName = pTarget.substr(lPos + 1, lEnd == string::npos ? string::npos : lEnd - lPos - 1);
+        if(any_of(begin(sPartialMatchParams), end(sPartialMatchParams), [&](const char* p){ return lName == p; })){
+            return false;
+        }
+        lPos = pTarget.find('&', lPos + 1);
+    }
+    return true;
+}
+
+void RequestCapture::record(const httplib::Request& req, const httplib::Response& res,
+                            chrono::steady_clock::duration pElapsed){
+    int64_t lElapsedMicros = chrono::duration_cast<chrono::microseconds>(pElapsed).count();
+    int64_t lNowMicros = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+    json lLine = {
+        {"ts_us", lNowMicros - lElapsedMicros},
+        {"method", req.method},
+        {"target", pseudonymizeTarget(req.target.empty() ? req.path : req.target)}
+    };
+    json lHeaders = json::object();
+    for(const char* lName : sCapturedHeaders){
+        if(req.has_header(lName)) lHeaders[lName] = req.get_header_value(lName);
+    }
+    if(!lHeaders.empty()) lLine["headers"] = move(lHeaders);
+
+    if(!req.body.empty()){
+        BodyEncoding lEncoding = ContentCodec::requestEncoding(req);
+        try{
+            json lBody = ContentCodec::decode(req.body, lEncoding);
+            redact(lBody);
+            pseudonymize(lBody);
+            lLine["body"] = move(lBody);
+            if(lEncoding != BodyEncoding::JSON) lLine["encoding"] = ContentCodec::name(lEncoding);
+        }
+        catch(const json::exception&){
+            lLine["body_invalid"] = true;
+        }
+    }
+    lLine["status"] = res.status;
+    lLine["latency_us"] = lElapsedMicros;
+
+    string lText = lLine.dump(-1, ' ', false, json::error_handler_t::replace);
+    lock_guard<mutex> lLock(mMutex);
+    // flushed per line: a capture is a debugging/benchmarking mode, and a crash should not
+    // take the most interesting last requests with it
+    mOut<<lText<<'\n'<<flush;
+}
+
+void RequestCapture::redact(json& pJson){
+    if(pJson.is_array()){
+        for(json& lItem : pJson) redact(lItem);
+        return;
+    }
+    if(!pJson.is_object()) return;
+    for(auto lIt = pJson.begin(); lIt != pJson.end(); ++lIt){
+        string lKey = lIt.key();
+        transform(lKey.begin(), lKey.end(), lKey.begin(), ::tolower);
+        if(lKey.find("password") != string::npos || lKey.find("secret") != string::npos ||
+           lKey.find("token") != string::npos){
+            lIt.value() = REDACTED;
+        }
+        else{
+            redact(lIt.value());
+        }
+    }
+}
+
+void RequestCapture::pseudonymize(json& pJson) const{
+    if(pJson.is_array()){
+        for(json& lItem : pJson) pseudonymize(lItem);
+        return;
+    }
+    if(!pJson.is_object()) return;
+    for(auto lIt = pJson.begin(); lIt != pJson.end(); ++lIt){
+        string lKey = lIt.key();
+        transform(lKey.begin(), lKey.end(), lKey.begin(), ::tolower);
+        bool lEmail = lKey.find("email") != string::npos;
+        if((lEmail || lKey.find("username") != string::npos) && lIt.value().is_string()){
+            lIt.value() = pseudonym(lIt.value().get<string>(), lEmail);
+        }
+        else{
+            pseudonymize(lIt.value());
+        }
+    }
+}
+
+vector<RequestCapture::Entry> RequestCapture::load(const string& pPath){
+    ifstream lIn(pPath);
+    if(!lIn){
+        throw runtime_error("Cannot open capture file: " + pPath);
+    }
+    vector<Entry> lEntries;
+    string lText;
+    size_t lLineNo = 0;
+    while(getline(lIn, lText)){
+        ++lLineNo;
+        if(lText.empty()) continue;
+        try{
+            json lLine = json::parse(lText);
+            Entry lEntry;
+            lEntry.tsMicros = lLine.value("ts_us", (int64_t)0);
+            lEntry.method = lLine.at("method").get<string>();
+            lEntry.target = lLine.at("target").get<string>();
+            if(lLine.contains("headers")){
+                for(auto& lHeader : lLine["headers"].items()){
+                    lEntry.headers.emplace(lHeader.key(), lHeader.value().get<string>());
+                }
+            }
+            if(lLine.contains("body")){
+                lEntry.hasBody = true;
+                lEntry.body = lLine["body"];
+            }
+            lEntry.bodyInvalid = lLine.value("body_invalid", false);
+            string lEncoding = lLine.value("encoding", string("JSON"));
+            if(lEncoding == ContentCodec::name(BodyEncoding::MSGPACK)) lEntry.encoding = BodyEncoding::MSGPACK;
+            else if(lEncoding == ContentCodec::name(BodyEncoding::CBOR)) lEntry.encoding = BodyEncoding::CBOR;
+            lEntry.status = lLine.value("status", 0);
+            lEntry.latencyMicros = lLine.value("latency_us", (int64_t)0);
+            lEntries.push_back(move(lEntry));
+        }
+        catch(const json::exception& e){
+            throw runtime_error(pPath + ":" + to_string(lLineNo) + ": " + e.what());
+        }
+    }
+    // workers append in completion order - replay wants arrival order
+    stable_sort(lEntries.begin(), lEntries.end(), [](const Entry& a, const Entry& b){ return a.tsMicros < b.tsMicros; });
+    return lEntries;
+}
+
+string RequestCapture::encodeBody(const Entry& pEntry){
+    if(pEntry.bodyInvalid) return "{\"captured\": invalid"; // exercises the same 400 path
+    if(!pEntry.hasBody) return "";
+    return ContentCodec::encode(pEntry.body, pEntry.encoding);
+}
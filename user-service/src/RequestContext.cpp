@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include "RequestContext.h"
+
+using namespace std;
+
+static thread_local RequestContext tContext;
+static thread_local bool tActive = false;
+
+RequestContext* RequestContext::current(){
+    return tActive ? &tContext : nullptr;
+}
+
+void RequestContext::begin(Clock::duration pQueueWait){
+    // a previous request on this thread whose response could not be written never reached
+    // end() - make sure its admission slot is not leaked
+    if(tActive) tContext.releaseAdmissionSlot();
+
+    tContext.mStart = Clock::now();
+    tContext.mQueueWait = pQueueWait;
+    tContext.mAdmissionSlot = nullptr;
+    tContext.mHasDeadline = false;
+    tContext.mPhaseCount = 0;
+    if(pQueueWait > Clock::duration::zero()){
+        tContext.addPhase("queue", pQueueWait);
+    }
+    tActive = true;
+}
+
+void RequestContext::end(){
+    tContext.releaseAdmissionSlot();
+    tActive = false;
+}
+
+void RequestContext::releaseAdmissionSlot(){
+    if(mAdmissionSlot){
+        mAdmissionSlot->fetch_sub(1, memory_order_relaxed);
+        mAdmissionSlot = nullptr;
+    }
+}
+
+// Longer client budgets are cut to this - 8 digits of hours (or an epoch ms far in the future)
+// would overflow the nanosecond clock, and no request legitimately runs for a day.
+static constexpr chrono::hours MAX_DEADLINE_BUDGET(24);
+
+template<typename Unit>
+static RequestContext::Clock::duration clampedTimeout(int64_t pAmount){
+    constexpr int64_t lMax = chrono::duration_cast<Unit>(MAX_DEADLINE_BUDGET).count();
+    if(pAmount > lMax) return MAX_DEADLINE_BUDGET;
+    return Unit(pAmount);
+}
+
+// grpc-timeout value: 1-8 digits followed by a unit - H(ours) M(inutes) S(econds)
+// m(illis) u(micros) n(anos). Returns false if malformed.
+static bool parseGrpcTimeout(const string& pValue, RequestContext::Clock::duration& pTimeout){
+    if(pValue.size() < 2 || pValue.size() > 9) return false;
+    int64_t lAmount = 0;
+    for(size_t i = 0; i + 1 < pValue.size(); ++i){
+        if(!isdigit((unsigned char)pValue[i])) return false;
+        lAmount = lAmount * 10 + (pValue[i] - '0');
+    }
+    switch(pValue.back()){
+        case 'H': pTimeout = clampedTimeout<chrono::hours>(lAmount); break;
+        case 'M': pTimeout = clampedTimeout<chrono::minutes>(lAmount); break;
+        case 'S': pTimeout = clampedTimeout<chrono::seconds>(lAmount); break;
+        case 'm': pTimeout = clampedTimeout<chrono::milliseconds>(lAmount); break;
+        case 'u': pTimeout = clampedTimeout<chrono::microseconds>(lAmount); break;
+        case 'n': pTimeout = clampedTimeout<chrono::nanoseconds>(lAmount); break;
+        default: return false;
+    }
+    return true;
+}
+
+void RequestContext::setDeadlineFromHeaders(const httplib::Request& pReq){
+    // malformed values are ignored - a bad header must not make us reject the request
+    Clock::duration lTimeout;
+    if(pReq.has_header("grpc-timeout") && parseGrpcTimeout(pReq.get_header_value("grpc-timeout"), lTimeout)){
+        mDeadline = mStart - mQueueWait + lTimeout;
+        mHasDeadline = true;
+    }
+    else if(pReq.has_header("X-Request-Deadline")){
+        try{
+            int64_t lDeadlineMs = stoll(pReq.get_header_value("X-Request-Deadline"));
+            // wall clock -> steady clock: take the remaining budget relative to "now"
+            int64_t lNowMs = chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            // compared, not subtracted first: the header can be anything stoll accepts
+            const int64_t lMaxMs = chrono::duration_cast<chrono::milliseconds>(MAX_DEADLINE_BUDGET).count();
+            int64_t lRemainingMs;
+            if(lDeadlineMs > lNowMs + lMaxMs) lRemainingMs = lMaxMs;
+            else if(lDeadlineMs < lNowMs - lMaxMs) lRemainingMs = -lMaxMs; // long past - expired either way
+            else lRemainingMs = lDeadlineMs - lNowMs;
+            mDeadline = Clock::now() + chrono::milliseconds(lRemainingMs);
+            mHasDeadline = true;
+        }
+        catch(const exception&){
+            // not a number - ignore
+        }
+    }
+}
+
+void RequestContext::checkDeadline(const char* pStage) const{
+    if(deadlineExceeded()){
+        // one counter per stage, created on first use (only a handful of stages exist)
+        MetricsRegistry::getInstance().counter("user_service_deadline_exceeded_total",
+            "Requests abandoned because the client deadline passed", string("stage=\"") + pStage + "\"").add();
+        throw DeadlineExceededError(pStage);
+    }
+}
+
+void RequestContext::addPhase(const char* pName, Clock::duration pDuration){
+    // same phase twice (e.g. two queries) -> one entry with the summed time
+    for(size_t i = 0; i < mPhaseCount; ++i){
+        if(mPhases[i].name == pName || strcmp(mPhases[i].name, pName) == 0){
+            mPhases[i].duration += pDuration;
+            return;
+        }
+    }
+    if(mPhaseCount < MAX_PHASES){
+        mPhases[mPhaseCount++] = Phase{pName, pDuration};
+    }
+}
+
+string RequestContext::serverTimingHeader() const{
+    string lHeader;
+    lHeader.reserve(32 * (mPhaseCount + 1));
+    char lBuffer[64];
+    auto lAppend = [&](const char* pName, Clock::duration pDuration){
+        double lMillis = chrono::duration<double, milli>(pDuration).count();
+        int lLen = snprintf(lBuffer, sizeof(lBuffer), "%s;dur=%.3f", pName, lMillis);
+        if(!lHeader.empty()) lHeader += ", ";
+        lHeader.append(lBuffer, lLen);
+    };
+    for(size_t i = 0; i < mPhaseCount; ++i){
+        lAppend(mPhases[i].name, mPhases[i].duration);
+    }
+    lAppend("total", elapsed());
+    return lHeader;
+}
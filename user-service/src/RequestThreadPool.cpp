@@ -0,0 +1,75 @@
+#include "RequestThreadPool.h"
+#include "Metrics.h"
+
+using namespace std;
+
+static thread_local chrono::steady_clock::duration tQueueWait{0};
+
+static LatencyHistogram& sQueueWaitLatency = MetricsRegistry::getInstance().histogram(
+    "user_service_threadpool_queue_wait_seconds", "Time a connection waited for a worker thread");
+
+// initialize static members
+atomic<size_t> RequestThreadPool::sQueueDepth{0};
+atomic<size_t> RequestThreadPool::sBusyThreads{0};
+atomic<size_t> RequestThreadPool::sThreadCount{0};
+
+RequestThreadPool::RequestThreadPool(size_t pThreadCount){
+    sThreadCount = pThreadCount;
+    for(size_t i = 0; i < pThreadCount; ++i){
+        mThreads.emplace_back(&RequestThreadPool::workerLoop, this);
+    }
+}
+
+RequestThreadPool::~RequestThreadPool(){
+    // httplib always calls shutdown() first; this only covers pools that never served
+    if(!mShutdown) shutdown();
+}
+
+bool RequestThreadPool::enqueue(function<void()> pTask){
+    {
+        lock_guard<mutex> lLock(mMtx);
+        mTasks.push_back(Task{move(pTask), chrono::steady_clock::now()});
+        sQueueDepth.store(mTasks.size(), memory_order_relaxed);
+    }
+    mCondition.notify_one();
+    return true;
+}
+
+void RequestThreadPool::shutdown(){
+    {
+        lock_guard<mutex> lLock(mMtx);
+        mShutdown = true;
+    }
+    mCondition.notify_all();
+    for(thread& lThread : mThreads){
+        if(lThread.joinable()) lThread.join();
+    }
+}
+
+void RequestThreadPool::workerLoop(){
+    for(;;){
+        Task lTask;
+        {
+            unique_lock<mutex> lLock(mMtx);
+            mCondition.wait(lLock, [this]{ return !mTasks.empty() || mShutdown; });
+            // drain: on shutdown, keep going until every queued connection is served
+            if(mShutdown && mTasks.empty()) break;
+
+            lTask = move(mTasks.front());
+            mTasks.pop_front();
+            sQueueDepth.store(mTasks.size(), memory_order_relaxed);
+        }
+        tQueueWait = chrono::steady_clock::now() - lTask.enqueuedAt;
+        sQueueWaitLatency.recordDuration(tQueueWait);
+
+        sBusyThreads.fetch_add(1, memory_order_relaxed);
+        lTask.fn();
+        sBusyThreads.fetch_sub(1, memory_order_relaxed);
+    }
+}
+
+chrono::steady_clock::duration RequestThreadPool::takeQueueWait(){
+    chrono::steady_clock::duration lWait = tQueueWait;
+    tQueueWait = chrono::steady_clock::duration::zero();
+    return lWait;
+}
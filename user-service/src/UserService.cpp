@@ -1,38 +1,128 @@
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <functional>
+#include <cstdio>
+#include <ctime>
+#include <thread>
 #include "UserService.h"
 #include "Logger.h"
 #include "PasswordService.h"
+#include "ContentCodec.h"
+#include "Metrics.h"
+#include "RequestThreadPool.h"
+#include "RequestContext.h"
 
 using namespace std;
 using json = nlohmann::json;
 
+// epoch ms -> "YYYY-MM-DD HH:MM:SS" (UTC) - the format created_at had when SQLite stored it as
+// text (CURRENT_TIMESTAMP), which clients still get
+static string formatTimestamp(int64_t pEpochMs){
+    time_t lSeconds = (time_t)(pEpochMs >= 0 ? pEpochMs / 1000 : (pEpochMs - 999) / 1000);
+    tm lTime;
+    gmtime_r(&lSeconds, &lTime);
+    char lText[32];
+    size_t lLength = strftime(lText, sizeof(lText), "%Y-%m-%d %H:%M:%S", &lTime);
+    return string(lText, lLength);
+}
+
 // **This function tells nlohmann::json how to convert our User struct into a JSON object.
 void to_json(json& pJson, const User& pUser){
     pJson = json{
         {"id", pUser.id},
         {"username", pUser.username},
         {"email", pUser.email},
-        {"created_at", pUser.created_at}
+        {"created_at", formatTimestamp(pUser.created_at_ms)}
     };
 }
 
 UserService::UserService(const string& pDBPath, string& pLogPath){
-    mDatabaseObj = make_unique<Database>(pDBPath);
     mLogger = FileLogger::getInstance(pLogPath);
+    mDatabaseObj = make_unique<Database>(pDBPath, mLogger);
     mPasswordService = make_unique<PasswordService>();
+
+    // Default admission limits. Every signup holds 64 MiB and a core for ~100ms of Argon2,
+    // so more concurrent signups than cores only adds queueing (and memory), not throughput.
+    mConcurrencyLimits["POST /users"] = max(2u, thread::hardware_concurrency());
+    // An export holds a worker thread (and a WAL snapshot) for as long as the client reads
+    mConcurrencyLimits["GET /admin/export"] = 1;
+
+    auto lStart = chrono::steady_clock::now();
+    syncUsernameIndex();
+    LOG_INFO(mLogger, "Username index loaded: {} users, {} nodes in {}ms", mUsernameIndex.size(), mUsernameIndex.nodeCount(),
+             chrono::duration<double, milli>(chrono::steady_clock::now() - lStart).count());
 }
 
 void UserService::setupRoutes(Server& pServer){
-    pServer.Get("/health", [this](const Request& req, Response& res){
+    // Our own pool instead of httplib's default one - same behaviour, but it reports queue depth
+    pServer.new_task_queue = []{ return new RequestThreadPool(CPPHTTPLIB_THREAD_POOL_COUNT); };
+
+    call_once(mRoutesBuilt, &UserService::buildRoutes, this);
+    for(const RouteEntry& lEntry : mRouteTable){
+        if(lEntry.method == "GET") pServer.Get(lEntry.pattern, lEntry.handler);
+        else pServer.Post(lEntry.pattern, lEntry.handler);
+    }
+
+    MetricsRegistry& lRegistry = MetricsRegistry::getInstance();
+    lRegistry.gauge("user_service_threadpool_queue_depth", "Connections waiting for a worker thread", "",
+                    []{ return (double)RequestThreadPool::queueDepth(); });
+    lRegistry.gauge("user_service_threadpool_busy_threads", "Worker threads currently serving a connection", "",
+                    []{ return (double)RequestThreadPool::busyThreads(); });
+    lRegistry.gauge("user_service_threadpool_threads", "Worker threads in the pool", "",
+                    []{ return (double)RequestThreadPool::threadCount(); });
+    lRegistry.gauge("user_service_username_index_users", "Users in the in-memory username suggest index", "",
+                    [this]{ return (double)mUsernameIndex.size(); });
+
+    // Start the request context before the body is read, so latency covers the whole request
+    pServer.set_pre_routing_handler([this](const Request& req, Response& res){
+        this->beginRequest(req);
+        return Server::HandlerResponse::Unhandled;
+    });
+
+    // Runs once the route is known (and the body is read), right before the handler
+    pServer.set_pre_request_handler([this](const Request& req, Response& res){
+        return this->admitRequest(req, res);
+    });
+
+    // Runs after the handler, right before the headers are written
+    pServer.set_post_routing_handler([this](const Request& req, Response& res){
+        this->finishHandler(req, res);
+    });
+
+    // Logging - called once the response has been written
+    pServer.set_logger([this](const Request& req, const Response& res){
+        this->finishRequest(req, res);
+    });
+}
+
+void UserService::buildRoutes(){
+    addRoute("GET", "/health", "/health", [this](const Request& req, Response& res){
         this->handleHealthCall(req, res);
     });
 
-    pServer.Post("/users", [this](const Request& req, Response& res){
+    addRoute("GET", "/ready", "/ready", [this](const Request& req, Response& res){
+        this->handleReady(req, res);
+    });
+
+    addRoute("POST", "/users", "/users", [this](const Request& req, Response& res){
         this->handleCreateUser(req, res);
     });
 
+    // lookups: /users?email=... or /users?username_prefix=...&limit=...&cursor=...
+    addRoute("GET", "/users", "/users", [this](const Request& req, Response& res){
+        this->handleListUsers(req, res);
+    });
+
+    // type-ahead: /users/suggest?q=<prefix>&limit=K
+    addRoute("GET", "/users/suggest", "/users/suggest", [this](const Request& req, Response& res){
+        this->handleSuggestUsers(req, res);
+    });
+
+    // substring search: /users/search?q=<text>&limit=N&cursor=C
+    addRoute("GET", "/users/search", "/users/search", [this](const Request& req, Response& res){
+        this->handleSearchUsers(req, res);
+    });
+
     // Regex Pattern breakdown
     // R - Raw string - no escaping needed: [e.g. without R: "/users/(\\d+)" ; with R: R"/users/(\\d+)"]
     // (  → Start capture group
@@ -40,14 +130,246 @@ void UserService::setupRoutes(Server& pServer){
     // \d → Matches any digit (0-9)
     // +  → One or more of the previous pattern
     // )  → End capture group
-    pServer.Get(R"(/users/(\d+))", [this](const Request& req, Response& res){
+    addRoute("GET", R"(/users/(\d+))", "/users/{id}", [this](const Request& req, Response& res){
         this->handleGetUser(req, res);
     });
 
-    // Logging
-    pServer.set_logger([this](const Request& req, const Response& res){
-        this->logMessage(req, res);
+    addRoute("GET", "/metrics", "/metrics", [this](const Request& req, Response& res){
+        this->handleMetrics(req, res);
+    });
+
+    // full dump for the data warehouse: /admin/export[?format=ndjson|csv]
+    addRoute("GET", "/admin/export", "/admin/export", [this](const Request& req, Response& res){
+        this->handleExport(req, res);
     });
+
+    // requests that match no route (404s, bad methods) still get counted
+    mUnmatchedRoute = makeRouteState("unmatched");
+}
+
+void UserService::beginRequest(const Request& req){
+    RequestContext::begin(RequestThreadPool::takeQueueWait());
+    RequestContext::current()->setDeadlineFromHeaders(req);
+}
+
+void UserService::finishHandler(const Request& req, Response& res){
+    RequestContext* lContext = RequestContext::current();
+    // handler is done - free the route's slot. Unless the body is streamed (content provider,
+    // e.g. /admin/export): httplib runs the provider after this hook, so the slot stays taken
+    // until finishRequest, which runs once the body has been written (or the write failed).
+    if(lContext && !res.content_provider_) lContext->releaseAdmissionSlot();
+    if(mServerTimingEnabled && lContext){
+        res.set_header("Server-Timing", lContext->serverTimingHeader());
+    }
+}
+
+void UserService::finishRequest(const Request& req, const Response& res){
+    const RouteState& lRoute = routeFor(req);
+    recordMetrics(req, res, lRoute);
+    logMessage(req, res, lRoute);
+    if(mCapture){
+        RequestContext* lContext = RequestContext::current();
+        mCapture->record(req, res, lContext ? lContext->elapsed() : chrono::steady_clock::duration::zero());
+    }
+    RequestContext::end();
+}
+
+// Same stages, in the same order, as httplib's Server::routing + process_request
+void UserService::dispatch(Request& req, Response& res){
+    call_once(mRoutesBuilt, &UserService::buildRoutes, this);
+
+    if(req.path.empty()){
+        // what httplib does with the request line: decoded path + query parameters
+        size_t lQuery = req.target.find('?');
+        req.path = detail::decode_path(req.target.substr(0, lQuery), false);
+        if(lQuery != string::npos) detail::parse_query_text(req.target.substr(lQuery + 1), req.params);
+    }
+    if(req.accept_content_types.empty() && req.has_header("Accept")){
+        detail::parse_accept_header(req.get_header_value("Accept"), req.accept_content_types);
+    }
+
+    beginRequest(req);
+    const RouteEntry* lMatched = nullptr;
+    // Literal routes are compared as strings: every failed regex_match allocates its match
+    // state, and /users/{id} - the hottest route - comes after all the other /users routes
+    for(const RouteEntry& lEntry : mRouteTable){
+        if(lEntry.method != req.method) continue;
+        if(lEntry.literal ? req.path == lEntry.pattern : regex_match(req.path, req.matches, lEntry.regex)){
+            lMatched = &lEntry;
+            break;
+        }
+    }
+    if(lMatched){
+        req.matched_route = lMatched->pattern;
+        if(admitRequest(req, res) == Server::HandlerResponse::Unhandled){
+            lMatched->handler(req, res);
+        }
+    }
+    else{
+        res.status = 404;
+    }
+    finishHandler(req, res);
+    finishRequest(req, res);
+}
+
+// Registers the handler in the route table and creates the route's metric series and admission
+// state up front, so the hot path only does a lookup in mRoutes (never modified after buildRoutes).
+// pLabel is the human readable route used in metric labels, e.g. "/users/{id}".
+void UserService::addRoute(const string& pMethod, const string& pPattern,
+                           const string& pLabel, Server::Handler pHandler){
+    if(pMethod != "GET" && pMethod != "POST") throw invalid_argument("addRoute: unsupported method " + pMethod);
+    bool lLiteral = pPattern.find_first_of("\\^$.|?*+()[]{}") == string::npos;
+    mRouteTable.push_back(RouteEntry{pMethod, pPattern, regex(pPattern), lLiteral, move(pHandler)});
+
+    RouteState lRoute = makeRouteState(pLabel);
+
+    auto lLimit = mConcurrencyLimits.find(pMethod + " " + pLabel);
+    if(lLimit != mConcurrencyLimits.end() && lLimit->second > 0){
+        lRoute.maxInFlight = lLimit->second;
+        shared_ptr<atomic<int>> lInFlight = lRoute.inFlight;
+        MetricsRegistry::getInstance().gauge("user_service_http_requests_in_flight",
+            "Requests currently running on routes with a concurrency limit", "route=\"" + pLabel + "\"",
+            [lInFlight]{ return (double)lInFlight->load(memory_order_relaxed); });
+    }
+
+    // "METHOD label" samples 2xx + 3xx, "METHOD label 2xx" one class (overrides the former)
+    const char* lStatusClasses[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    for(int i = 0; i < 5; ++i){
+        auto lRule = mAccessLogRules.find(pMethod + " " + pLabel + " " + lStatusClasses[i]);
+        if(lRule == mAccessLogRules.end() && (i == 1 || i == 2)){
+            lRule = mAccessLogRules.find(pMethod + " " + pLabel);
+        }
+        if(lRule == mAccessLogRules.end()) continue;
+        lRoute.logSamplers[i] = AccessLogSampler::parse(lRule->second);
+        lRoute.logSampledOut[i] = &MetricsRegistry::getInstance().counter("user_service_access_log_sampled_out_total",
+            "Access log lines skipped by sampling (requests still counted in user_service_http_requests_total)",
+            "route=\"" + pLabel + "\",status=\"" + lStatusClasses[i] + "\",rule=\"" + lRule->second + "\"");
+    }
+
+    // httplib (and dispatch) report the matched pattern in req.matched_route
+    mRoutes[pMethod + " " + pPattern] = lRoute;
+}
+
+UserService::RouteState UserService::makeRouteState(const string& pLabel){
+    MetricsRegistry& lRegistry = MetricsRegistry::getInstance();
+    string lRouteLabel = "route=\"" + pLabel + "\"";
+
+    RouteState lRoute;
+    lRoute.inFlight = make_shared<atomic<int>>(0);
+    lRoute.shedQueueDeadline = &lRegistry.counter("user_service_requests_shed_total",
+        "Requests rejected with 503 by admission control", lRouteLabel + ",reason=\"queue_deadline\"");
+    lRoute.shedConcurrency = &lRegistry.counter("user_service_requests_shed_total",
+        "Requests rejected with 503 by admission control", lRouteLabel + ",reason=\"concurrency_limit\"");
+    const char* lStatusClasses[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    for(int i = 0; i < 5; ++i){
+        lRoute.requestsByStatusClass[i] = &lRegistry.counter("user_service_http_requests_total",
+            "HTTP requests by route and status class", lRouteLabel + ",status=\"" + lStatusClasses[i] + "\"");
+    }
+    lRoute.latency = &lRegistry.histogram("user_service_http_request_duration_seconds",
+        "HTTP request latency, from routing until the response is written", lRouteLabel);
+    return lRoute;
+}
+
+// Admission control, in front of every handler:
+//  1. queue deadline - the connection sat in the thread-pool queue longer than mMaxQueueWait;
+//     the client has most likely given up already, so don't spend Argon2/DB time on it
+//  2. concurrency limit - the route already runs maxInFlight requests
+// Either way the request gets a cheap 503 + Retry-After instead of the handler.
+Server::HandlerResponse UserService::admitRequest(const Request& req, Response& res){
+    RequestContext* lContext = RequestContext::current();
+    auto lIt = mRoutes.find(req.method + " " + req.matched_route);
+    if(!lContext || lIt == mRoutes.end()) return Server::HandlerResponse::Unhandled;
+    RouteState& lRoute = lIt->second;
+
+    if(mMaxQueueWait.count() > 0 && lContext->queueWait() > mMaxQueueWait){
+        lRoute.shedQueueDeadline->add();
+        rejectOverloaded(req, res, "Request waited too long in queue, server is overloaded.");
+        return Server::HandlerResponse::Handled;
+    }
+
+    if(lRoute.maxInFlight > 0){
+        // optimistic increment - undo it if that took us over the limit
+        if(lRoute.inFlight->fetch_add(1, memory_order_relaxed) >= lRoute.maxInFlight){
+            lRoute.inFlight->fetch_sub(1, memory_order_relaxed);
+            lRoute.shedConcurrency->add();
+            rejectOverloaded(req, res, "Too many concurrent requests for this endpoint.");
+            return Server::HandlerResponse::Handled;
+        }
+        lContext->setAdmissionSlot(lRoute.inFlight.get());
+    }
+    return Server::HandlerResponse::Unhandled;
+}
+
+void UserService::rejectOverloaded(const Request& req, Response& res, const string& pMessage){
+    json lResJson = {
+        {"status", "ERROR"},
+        {"message", pMessage}
+    };
+    res.status = 503; // Service Unavailable
+    res.set_header("Retry-After", "1");
+    sendResponse(req, res, lResJson);
+}
+
+void UserService::setConcurrencyLimit(const string& pRoute, int pMaxInFlight){
+    mConcurrencyLimits[pRoute] = pMaxInFlight;
+}
+
+void UserService::setMaxQueueWait(chrono::milliseconds pMaxQueueWait){
+    mMaxQueueWait = pMaxQueueWait;
+}
+
+void UserService::setAccessLogSampling(const string& pRoute, const string& pRule){
+    AccessLogSampler::parse(pRule); // validate now, not at setupRoutes time
+    mAccessLogRules[pRoute] = pRule;
+}
+
+void UserService::setSlowRequestLogThreshold(chrono::milliseconds pThreshold){
+    mSlowRequestLogThreshold = pThreshold;
+}
+
+void UserService::warmUp(){
+    mDatabaseObj->prewarm();
+    setReady(true);
+}
+
+void UserService::setReady(bool pReady){
+    mReady.store(pReady, memory_order_release);
+}
+
+void UserService::setAdminToken(const string& pToken){
+    mAdminToken = pToken;
+}
+
+bool UserService::isAdmin(const Request& req) const{
+    if(mAdminToken.empty()) return false;
+    string lExpected = "Bearer " + mAdminToken;
+    const string& lGiven = req.get_header_value("Authorization");
+    // compare every byte - how long a mismatch takes says nothing about where it is
+    unsigned char lDiff = (lGiven.size() != lExpected.size());
+    for(size_t i = 0; i < lExpected.size(); ++i){
+        lDiff |= (unsigned char)(lExpected[i] ^ (i < lGiven.size() ? lGiven[i] : 0));
+    }
+    return lDiff == 0;
+}
+
+void UserService::setCapture(shared_ptr<RequestCapture> pCapture){
+    mCapture = move(pCapture);
+}
+
+const UserService::RouteState& UserService::routeFor(const Request& req) const{
+    auto lIt = mRoutes.find(req.method + " " + req.matched_route);
+    return (lIt != mRoutes.end()) ? lIt->second : mUnmatchedRoute;
+}
+
+void UserService::recordMetrics(const Request& req, const Response& res, const RouteState& lRoute){
+    int lStatusClass = res.status / 100 - 1;
+    if(lStatusClass >= 0 && lStatusClass < 5){
+        lRoute.requestsByStatusClass[lStatusClass]->add();
+    }
+    // requests rejected before routing (malformed request line, ...) have no context
+    if(RequestContext* lContext = RequestContext::current()){
+        lRoute.latency->recordDuration(lContext->elapsed());
+    }
 }
 
 
@@ -59,13 +381,29 @@ void UserService::handleHealthCall(const Request& req, Response& res){
         {"timestamp", time(nullptr)}
     };
     res.status = 200;
-    res.set_content(lJson.dump(4), "application/json");
+    sendResponse(req, res, lJson);
+}
+
+// Readiness, unlike /health (liveness): only 200 once the instance is warmed up
+void UserService::handleReady(const Request& req, Response& res){
+    bool lReady = mReady.load(memory_order_acquire);
+    json lJson = {
+        {"status", lReady ? "READY" : "WARMING_UP"}
+    };
+    res.status = lReady ? 200 : 503;
+    if(!lReady) res.set_header("Retry-After", "1");
+    sendResponse(req, res, lJson);
 }
 
 void UserService::handleCreateUser(const Request& req, Response& res){
     try{
-        // In POST calls, data comes in "body" of the request
-        json lBodyJson = json::parse(req.body);
+        // In POST calls, data comes in "body" of the request - JSON, MessagePack or CBOR,
+        // depending on the Content-Type header
+        json lBodyJson;
+        {
+            PhaseTimer lTimer("parse");
+            lBodyJson = ContentCodec::decode(req.body, ContentCodec::requestEncoding(req));
+        }
         // Now, to create user we need following params - username, email, password
         // So, first make sure all are present in the request body
         if(!lBodyJson.contains("username")||
@@ -76,23 +414,29 @@ void UserService::handleCreateUser(const Request& req, Response& res){
         string lUsername = lBodyJson["username"];
         string lEmailId = lBodyJson["email"];
         string lPassword = lBodyJson["password"];
+
+        // Don't start the expensive stages if the caller has already given up on us
+        RequestContext* lContext = RequestContext::current();
+        if(lContext) lContext->checkDeadline("hashPassword");
         string lHashedPassword = mPasswordService->hashPassword(lPassword);
 
+        if(lContext) lContext->checkDeadline("createUser");
         int lUserId = mDatabaseObj->createUser(lUsername, lEmailId, lHashedPassword);
+        mUsernameIndex.insert(lUsername, lUserId); // suggestable right away, no catch-up needed
         json lResJson = {
             {"status", "SUCCESS"},
             {"data", to_string(lUserId)}
         };
         res.status = 201; // Resource created
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
     catch(const json::parse_error& e){
         json lResJson = {
             {"status", "ERROR"}, 
-            {"message", "Invalid JSON Format"}
+            {"message", "Invalid " + string(ContentCodec::name(ContentCodec::requestEncoding(req))) + " Format"}
         };
         res.status = 400; // Bad Request
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
     catch(const invalid_argument& e){
         json lResJson = {
@@ -100,7 +444,15 @@ void UserService::handleCreateUser(const Request& req, Response& res){
             {"message", e.what()}
         };
         res.status = 400; // Bad Request
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
+    }
+    catch(const DeadlineExceededError& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 504; // Gateway Timeout - the caller's deadline passed
+        sendResponse(req, res, lResJson);
     }
     catch(const exception& e){
         json lResJson = {
@@ -108,7 +460,7 @@ void UserService::handleCreateUser(const Request& req, Response& res){
             {"message", e.what()}
         };
         res.status = 500; // Internal Server Error
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
 }
 
@@ -117,6 +469,23 @@ void UserService::handleGetUser(const Request& req, Response& res){
     // BUT NOT HERE
     try{
         int lUserId = stoi(req.matches[1]); // 1 because index start from 0: req.matches[0] = "/users/123"  (entire match)
+        BodyEncoding lEncoding = ContentCodec::negotiate(req);
+
+        // Conditional GET: if the client already has the current version, answer 304 without
+        // loading the row or serializing anything (the version usually comes from cache)
+        if(req.has_header("If-None-Match")){
+            optional<int64_t> lVersion = mDatabaseObj->getUserVersion(lUserId);
+            if(lVersion.has_value()){
+                string lETag = makeETag(lUserId, *lVersion, lEncoding);
+                if(etagMatches(req.get_header_value("If-None-Match"), lETag)){
+                    res.status = 304; // Not Modified - no body
+                    res.set_header("ETag", lETag);
+                    res.set_header("Vary", "Accept");
+                    return;
+                }
+            }
+        }
+
         optional<User> lUserData = mDatabaseObj->getUserById(lUserId);
 
         json lResJson = json::object();
@@ -126,6 +495,7 @@ void UserService::handleGetUser(const Request& req, Response& res){
 
             json lUserJson = *lUserData;
             lResJson["data"] = lUserJson;
+            res.set_header("ETag", makeETag(lUserData->id, lUserData->version, lEncoding));
         }
         else{
             lResJson["status"] = "ERROR";
@@ -133,7 +503,7 @@ void UserService::handleGetUser(const Request& req, Response& res){
             res.status = 404; // Missing Resource
         }
 
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
     catch(const invalid_argument& e){
         json lResJson = {
@@ -141,7 +511,7 @@ void UserService::handleGetUser(const Request& req, Response& res){
             {"message", e.what()}
         };
         res.status = 400; // Bad Request
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
     catch(const runtime_error& e){
         json lResJson = {
@@ -149,7 +519,7 @@ void UserService::handleGetUser(const Request& req, Response& res){
             {"message", e.what()}
         };
         res.status = 404; // Not Found
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
     catch(const exception& e){
         json lResJson = {
@@ -157,13 +527,463 @@ void UserService::handleGetUser(const Request& req, Response& res){
             {"message", e.what()}
         };
         res.status = 500; // Internal Server Error
-        res.set_content(lResJson.dump(4), "application/json");
+        sendResponse(req, res, lResJson);
     }
 }
 
-void UserService::logMessage(const Request& req, const Response& res){
-    string lLogMessage = req.method + " " + req.path + " - " + to_string(res.status);
-    mLogger->log(lLogMessage, LOG_LEVEL::INFO);
+// GET /users?email=<exact email>                       -> 0 or 1 user (UNIQUE index)
+// GET /users?username_prefix=<p>[&limit=N][&cursor=C]   -> users whose name starts with p,
+//     case-insensitive, ordered by name; "next_cursor" is set when there may be more
+// GET /users?created_after=<t>&created_before=<t>[&limit=N][&cursor=C] -> users created in
+//     between (both exclusive, either may be left out), oldest first
+// Always a list in "data", so clients handle both the same way.
+void UserService::handleListUsers(const Request& req, Response& res){
+    try{
+        json lResJson = {
+            {"status", "SUCCESS"},
+            {"data", json::array()}
+        };
+        if(req.has_param("email")){
+            optional<User> lUser = mDatabaseObj->getUserByEmail(req.get_param_value("email"));
+            if(lUser.has_value()) lResJson["data"].push_back(*lUser);
+        }
+        else if(req.has_param("username_prefix")){
+            // normalized like the index: surrounding whitespace never matches, case is ignored
+            string lPrefix = req.get_param_value("username_prefix");
+            size_t lFirst = lPrefix.find_first_not_of(" \t");
+            size_t lLast = lPrefix.find_last_not_of(" \t");
+            lPrefix = (lFirst == string::npos) ? "" : lPrefix.substr(lFirst, lLast - lFirst + 1);
+            if(lPrefix.empty() || lPrefix.size() > 64){
+                throw invalid_argument("username_prefix must be 1 to 64 characters");
+            }
+
+            int lLimit = pageLimit(req);
+            optional<UsernameCursor> lAfter;
+            if(req.has_param("cursor")) lAfter = decodeCursor(req.get_param_value("cursor"));
+
+            vector<User> lUsers = mDatabaseObj->findUsersByUsernamePrefix(lPrefix, lLimit, lAfter);
+            for(const User& lUser : lUsers) lResJson["data"].push_back(lUser);
+            // a full page may have a successor - an extra query to make sure isn't worth it
+            if((int)lUsers.size() == lLimit){
+                lResJson["next_cursor"] = encodeCursor({lUsers.back().username, lUsers.back().id});
+            }
+        }
+        else if(req.has_param("created_after") || req.has_param("created_before")){
+            int64_t lAfter = req.has_param("created_after") ? parseTimestamp(req.get_param_value("created_after")) : -1;
+            int64_t lBefore = req.has_param("created_before") ? parseTimestamp(req.get_param_value("created_before")) : INT64_MAX;
+
+            int lLimit = pageLimit(req);
+            optional<CreatedAtCursor> lCursor;
+            if(req.has_param("cursor")) lCursor = decodeCreatedAtCursor(req.get_param_value("cursor"));
+
+            vector<User> lUsers = mDatabaseObj->findUsersByCreatedAt(lAfter, lBefore, lLimit, lCursor);
+            for(const User& lUser : lUsers) lResJson["data"].push_back(lUser);
+            if((int)lUsers.size() == lLimit){
+                lResJson["next_cursor"] = encodeCreatedAtCursor({lUsers.back().created_at_ms, lUsers.back().id});
+            }
+        }
+        else{
+            throw invalid_argument("Query parameter email, username_prefix, created_after or created_before is required");
+        }
+        res.status = 200;
+        sendResponse(req, res, lResJson);
+    }
+    catch(const invalid_argument& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 400; // Bad Request
+        sendResponse(req, res, lResJson);
+    }
+    catch(const exception& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 500; // Internal Server Error
+        sendResponse(req, res, lResJson);
+    }
+}
+
+// GET /users/suggest?q=<prefix>[&limit=K] -> up to K (default 10) {id, username}, served from
+// mUsernameIndex: names starting with q (case-insensitive), shortest first
+void UserService::handleSuggestUsers(const Request& req, Response& res){
+    try{
+        string lQuery = UsernameIndex::normalize(req.get_param_value("q"));
+        if(lQuery.empty() || lQuery.size() > 64){
+            throw invalid_argument("q must be 1 to 64 characters");
+        }
+        int lLimit = pageLimit(req, 10);
+
+        syncUsernameIndex();
+        json lResJson = {
+            {"status", "SUCCESS"},
+            {"data", json::array()}
+        };
+        {
+            PhaseTimer lTimer("suggest");
+            for(const UsernameIndex::Suggestion& lSuggestion : mUsernameIndex.suggest(lQuery, (size_t)lLimit)){
+                lResJson["data"].push_back({{"id", lSuggestion.id}, {"username", lSuggestion.username}});
+            }
+        }
+        res.status = 200;
+        sendResponse(req, res, lResJson);
+    }
+    catch(const invalid_argument& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 400; // Bad Request
+        sendResponse(req, res, lResJson);
+    }
+    catch(const exception& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 500; // Internal Server Error
+        sendResponse(req, res, lResJson);
+    }
+}
+
+// GET /users/search?q=<text>[&limit=N][&cursor=C] -> users with q anywhere in username or email,
+// case-insensitive, best matches first (FTS5 trigram index + bm25). Ranks shift as users are
+// added, so pages are plain offsets - a cursor is only good for going a little deeper, and
+// past MAX_SEARCH_OFFSET matches the caller should refine q instead of paging.
+// "partial": true while rows from before the index existed are still being indexed.
+void UserService::handleSearchUsers(const Request& req, Response& res){
+    const int MAX_SEARCH_OFFSET = 1000;
+    try{
+        string lQuery = req.get_param_value("q");
+        size_t lFirst = lQuery.find_first_not_of(" \t");
+        size_t lLast = lQuery.find_last_not_of(" \t");
+        lQuery = (lFirst == string::npos) ? "" : lQuery.substr(lFirst, lLast - lFirst + 1);
+        // trigrams: shorter strings have no index entry to look up
+        if(lQuery.size() < 3 || lQuery.size() > 64){
+            throw invalid_argument("q must be 3 to 64 characters");
+        }
+        int lLimit = pageLimit(req);
+        int lOffset = 0;
+        if(req.has_param("cursor")){
+            const string& lCursor = req.get_param_value("cursor");
+            if(lCursor.empty() || lCursor.size() > 4 || lCursor.find_first_not_of("0123456789") != string::npos ||
+               stoi(lCursor) > MAX_SEARCH_OFFSET){
+                throw invalid_argument("Invalid cursor");
+            }
+            lOffset = stoi(lCursor);
+        }
+
+        vector<User> lUsers = mDatabaseObj->searchUsers(lQuery, lLimit, lOffset);
+        json lResJson = {
+            {"status", "SUCCESS"},
+            {"data", json::array()}
+        };
+        for(const User& lUser : lUsers) lResJson["data"].push_back(lUser);
+        if((int)lUsers.size() == lLimit && lOffset + lLimit <= MAX_SEARCH_OFFSET){
+            lResJson["next_cursor"] = to_string(lOffset + lLimit);
+        }
+        if(!mDatabaseObj->searchIndexComplete()) lResJson["partial"] = true;
+        res.status = 200;
+        sendResponse(req, res, lResJson);
+    }
+    catch(const invalid_argument& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 400; // Bad Request
+        sendResponse(req, res, lResJson);
+    }
+    catch(const exception& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 500; // Internal Server Error
+        sendResponse(req, res, lResJson);
+    }
+}
+
+// CSV field (RFC 4180): quoted only when it has to be, quotes doubled
+static void appendCsvField(string& pOut, const string& pValue){
+    if(pValue.find_first_of(",\"\r\n") == string::npos){
+        pOut += pValue;
+        return;
+    }
+    pOut += '"';
+    for(char c : pValue){
+        if(c == '"') pOut += '"';
+        pOut += c;
+    }
+    pOut += '"';
+}
+
+// GET /admin/export[?format=ndjson|csv] -> every user, one per line, in id order (NDJSON by
+// default: the same objects as GET /users/{id}).
+// The rows come from a UserSnapshot - its own read-only connection and read transaction, so the
+// dump is consistent as of the request and signups/gets carry on meanwhile (WAL). The body is
+// streamed with chunked transfer encoding: httplib calls the provider whenever the socket can
+// take more, each call sends ~64 KiB, and one buffer is reused - memory doesn't grow with the
+// table, and a slow client just slows the provider down.
+void UserService::handleExport(const Request& req, Response& res){
+    const size_t EXPORT_CHUNK_BYTES = 64 * 1024;
+    try{
+        if(!isAdmin(req)){
+            res.status = mAdminToken.empty() ? 404 : 401; // disabled: as if the route didn't exist
+            if(res.status == 401) res.set_header("WWW-Authenticate", "Bearer");
+            sendResponse(req, res, {{"status", "ERROR"}, {"message", res.status == 401 ? "Unauthorized" : "Not Found"}});
+            return;
+        }
+        string lFormat = req.has_param("format") ? req.get_param_value("format") : "ndjson";
+        if(lFormat != "ndjson" && lFormat != "csv"){
+            throw invalid_argument("format must be ndjson or csv");
+        }
+        bool lCsv = (lFormat == "csv");
+
+        struct ExportState {
+            unique_ptr<UserSnapshot> snapshot;
+            string chunk;
+            User user;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        };
+        auto lState = make_shared<ExportState>();
+        lState->snapshot = mDatabaseObj->openSnapshot();
+        lState->chunk.reserve(EXPORT_CHUNK_BYTES + 1024);
+        if(lCsv) lState->chunk = "id,username,email,created_at\r\n";
+
+        res.status = 200;
+        res.set_header("Content-Disposition", string("attachment; filename=\"users.") + (lCsv ? "csv" : "ndjson") + "\"");
+        shared_ptr<ILogger> lLogger = mLogger;
+        res.set_chunked_content_provider(lCsv ? "text/csv; charset=utf-8" : "application/x-ndjson",
+            [lState, lCsv, lLogger, EXPORT_CHUNK_BYTES](size_t, DataSink& pSink){
+                try{
+                    bool lMore = true;
+                    while(lState->chunk.size() < EXPORT_CHUNK_BYTES && (lMore = lState->snapshot->next(lState->user))){
+                        const User& lUser = lState->user;
+                        if(lCsv){
+                            lState->chunk += to_string(lUser.id);
+                            lState->chunk += ',';
+                            appendCsvField(lState->chunk, lUser.username);
+                            lState->chunk += ',';
+                            appendCsvField(lState->chunk, lUser.email);
+                            lState->chunk += ',';
+                            lState->chunk += formatTimestamp(lUser.created_at_ms);
+                            lState->chunk += "\r\n";
+                        }
+                        else{
+                            lState->chunk += json(lUser).dump();
+                            lState->chunk += '\n';
+                        }
+                    }
+                    if(!lState->chunk.empty() && !pSink.write(lState->chunk.data(), lState->chunk.size())){
+                        return false; // client went away
+                    }
+                    lState->chunk.clear(); // keeps the capacity
+                    if(!lMore) pSink.done();
+                    return true;
+                }
+                catch(const exception& e){
+                    // the headers are out already - cutting the connection short (no final
+                    // chunk) is how the client learns the dump is incomplete
+                    LOG_ERROR(lLogger, "Export failed after {} rows: {}", lState->snapshot->rowsRead(), e.what());
+                    return false;
+                }
+            },
+            [lState, lLogger](bool pSuccess){
+                LOG_INFO(lLogger, "Export {}: {} rows in {}ms", pSuccess ? "done" : "aborted", lState->snapshot->rowsRead(),
+                         chrono::duration<double, milli>(chrono::steady_clock::now() - lState->start).count());
+                lState->snapshot.reset(); // ends the read transaction now, not when the response is freed
+            });
+    }
+    catch(const invalid_argument& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 400; // Bad Request
+        sendResponse(req, res, lResJson);
+    }
+    catch(const exception& e){
+        json lResJson = {
+            {"status", "ERROR"},
+            {"message", e.what()}
+        };
+        res.status = 500; // Internal Server Error
+        sendResponse(req, res, lResJson);
+    }
+}
+
+// Only reads the table when another connection has committed since the last time (data_version
+// moved) - then just the rows above the last loaded id. Our own signups are inserted by
+// handleCreateUser and show up here again at most once; insert() ignores those duplicates.
+// (Users are never renamed or deleted, so new rows are all there is to catch up on.)
+void UserService::syncUsernameIndex(){
+    int64_t lDataVersion = mDatabaseObj->readDataVersion();
+    if(lDataVersion == mUsernameIndexDataVersion.load(memory_order_acquire)) return;
+
+    lock_guard<mutex> lLock(mUsernameIndexSyncMtx);
+    if(lDataVersion == mUsernameIndexDataVersion.load(memory_order_relaxed)) return; // another thread did it
+    mUsernameIndexLoadedId = mDatabaseObj->forEachUsername(mUsernameIndexLoadedId, [this](int pId, const string& pUsername){
+        mUsernameIndex.insert(pUsername, pId);
+    });
+    mUsernameIndexDataVersion.store(lDataVersion, memory_order_release);
+}
+
+void UserService::handleMetrics(const Request& req, Response& res){
+    res.status = 200;
+    res.set_content(MetricsRegistry::getInstance().render(), "text/plain; version=0.0.4");
+}
+
+// Strong ETag for one representation of a user: id + row version + encoding.
+// The encoding is part of it because JSON and MessagePack bodies are different bytes, and a
+// strong ETag must identify the exact representation (Vary: Accept).
+string UserService::makeETag(int pUserId, int64_t pVersion, BodyEncoding pEncoding){
+    return "\"" + to_string(pUserId) + "-" + to_string(pVersion) + "-" + ContentCodec::name(pEncoding) + "\"";
+}
+
+// If-None-Match: "*" or a comma separated list of (possibly weak, W/"...") entity tags.
+// RFC 9110 uses the weak comparison here, so a W/ prefix is ignored.
+bool UserService::etagMatches(const string& pIfNoneMatch, const string& pETag){
+    size_t lPos = 0;
+    while(lPos < pIfNoneMatch.size()){
+        size_t lEnd = pIfNoneMatch.find(',', lPos);
+        if(lEnd == string::npos) lEnd = pIfNoneMatch.size();
+
+        string lTag = pIfNoneMatch.substr(lPos, lEnd - lPos);
+        size_t lFirst = lTag.find_first_not_of(" \t");
+        size_t lLast = lTag.find_last_not_of(" \t");
+        lTag = (lFirst == string::npos) ? "" : lTag.substr(lFirst, lLast - lFirst + 1);
+        if(lTag.rfind("W/", 0) == 0) lTag = lTag.substr(2);
+
+        if(lTag == "*" || lTag == pETag) return true;
+        lPos = lEnd + 1;
+    }
+    return false;
+}
+
+// "limit" query parameter: 1..100, default pDefault
+int UserService::pageLimit(const Request& req, int pDefault){
+    if(!req.has_param("limit")) return pDefault;
+    const string& lValue = req.get_param_value("limit");
+    if(lValue.empty() || lValue.size() > 3 || lValue.find_first_not_of("0123456789") != string::npos){
+        throw invalid_argument("limit must be a number between 1 and 100");
+    }
+    int lLimit = stoi(lValue);
+    if(lLimit < 1 || lLimit > 100){
+        throw invalid_argument("limit must be a number between 1 and 100");
+    }
+    return lLimit;
+}
+
+// Cursors are opaque to clients: "<hex of the username>.<id>" - hex so any username survives
+// the query string without escaping rules
+string UserService::encodeCursor(const UsernameCursor& pCursor){
+    static const char* sHex = "0123456789abcdef";
+    string lCursor;
+    lCursor.reserve(pCursor.username.size() * 2 + 12);
+    for(unsigned char c : pCursor.username){
+        lCursor += sHex[c >> 4];
+        lCursor += sHex[c & 0xF];
+    }
+    return lCursor + "." + to_string(pCursor.id);
+}
+
+UsernameCursor UserService::decodeCursor(const string& pCursor){
+    size_t lDot = pCursor.find('.');
+    if(lDot == string::npos || lDot % 2 != 0 || lDot + 1 >= pCursor.size() || pCursor.size() - lDot > 10 ||
+       pCursor.find_first_not_of("0123456789abcdef") != lDot ||
+       pCursor.find_first_not_of("0123456789", lDot + 1) != string::npos){
+        throw invalid_argument("Invalid cursor");
+    }
+    UsernameCursor lCursor;
+    for(size_t i = 0; i < lDot; i += 2){
+        lCursor.username += (char)stoi(pCursor.substr(i, 2), nullptr, 16);
+    }
+    lCursor.id = stoi(pCursor.substr(lDot + 1));
+    return lCursor;
+}
+
+// "<created_at_ms>.<id>"
+string UserService::encodeCreatedAtCursor(const CreatedAtCursor& pCursor){
+    return to_string(pCursor.createdAtMs) + "." + to_string(pCursor.id);
+}
+
+CreatedAtCursor UserService::decodeCreatedAtCursor(const string& pCursor){
+    size_t lDot = pCursor.find('.');
+    if(lDot == string::npos || lDot == 0 || lDot > 15 || lDot + 1 >= pCursor.size() || pCursor.size() - lDot > 10 ||
+       pCursor.find_first_not_of("0123456789") != lDot ||
+       pCursor.find_first_not_of("0123456789", lDot + 1) != string::npos){
+        throw invalid_argument("Invalid cursor");
+    }
+    CreatedAtCursor lCursor;
+    lCursor.createdAtMs = stoll(pCursor.substr(0, lDot));
+    lCursor.id = stoi(pCursor.substr(lDot + 1));
+    return lCursor;
+}
+
+int64_t UserService::parseTimestamp(const string& pValue){
+    // all digits: epoch milliseconds (up to year 33658 - anything longer is a typo)
+    if(!pValue.empty() && pValue.size() <= 15 && pValue.find_first_not_of("0123456789") == string::npos){
+        return stoll(pValue);
+    }
+    // a date, optionally with a time - what created_at looks like in responses, or ISO 8601
+    tm lTime = {};
+    char lSeparator = ' ';
+    int lConsumed = 0;
+    int lFields = sscanf(pValue.c_str(), "%4d-%2d-%2d%n%c%2d:%2d:%2d%n", &lTime.tm_year, &lTime.tm_mon, &lTime.tm_mday,
+                         &lConsumed, &lSeparator, &lTime.tm_hour, &lTime.tm_min, &lTime.tm_sec, &lConsumed);
+    size_t lEnd = (size_t)lConsumed;
+    if(lEnd < pValue.size() && pValue[lEnd] == 'Z' && lFields == 7) ++lEnd;
+    if((lFields != 3 && lFields != 7) || lEnd != pValue.size() || (lFields == 7 && lSeparator != ' ' && lSeparator != 'T') ||
+       lTime.tm_mon < 1 || lTime.tm_mon > 12 || lTime.tm_mday < 1 || lTime.tm_mday > 31 ||
+       lTime.tm_hour > 23 || lTime.tm_min > 59 || lTime.tm_sec > 60){
+        throw invalid_argument("Invalid timestamp '" + pValue + "': use epoch milliseconds or YYYY-MM-DD[ HH:MM:SS] (UTC)");
+    }
+    lTime.tm_year -= 1900;
+    lTime.tm_mon -= 1;
+    return (int64_t)timegm(&lTime) * 1000;
+}
+
+// Serializes the response body in the encoding the client asked for (Accept header):
+// JSON by default, MessagePack/CBOR for internal callers that don't want to parse text.
+void UserService::sendResponse(const Request& req, Response& res, const json& pBody){
+    PhaseTimer lTimer("encode");
+    BodyEncoding lEncoding = ContentCodec::negotiate(req);
+    res.set_header("Vary", "Accept"); // caches must key on Accept, the body differs per encoding
+    res.set_content(ContentCodec::encode(pBody, lEncoding), ContentCodec::contentType(lEncoding));
+}
+
+void UserService::setServerTiming(bool pEnabled){
+    mServerTimingEnabled = pEnabled;
+}
+
+// The macro checks the level first - with the level below INFO an access line costs one atomic
+// load, nothing is formatted or allocated.
+// Sampled routes (setAccessLogSampling) only log some of their requests; errors without a rule of
+// their own and slow requests are always logged. Skipped lines are counted per route and status
+// class, together with user_service_http_requests_total that gives the true rates back.
+void UserService::logMessage(const Request& req, const Response& res, const RouteState& pRoute){
+    if(!mLogger->isEnabled(LOG_LEVEL::INFO)) return;
+
+    RequestContext* lContext = RequestContext::current();
+    int lStatusClass = res.status / 100 - 1;
+    if(lStatusClass >= 0 && lStatusClass < 5 && pRoute.logSamplers[lStatusClass]){
+        bool lSlow = lContext && lContext->elapsed() >= mSlowRequestLogThreshold;
+        if(!lSlow && !pRoute.logSamplers[lStatusClass]->shouldLog()){
+            pRoute.logSampledOut[lStatusClass]->add();
+            return;
+        }
+    }
+
+    if(lContext){
+        LOG_INFO(mLogger, "{} {} - {} - {}ms", req.method, req.path, res.status,
+                 chrono::duration<double, milli>(lContext->elapsed()).count());
+    }
+    else{
+        LOG_INFO(mLogger, "{} {} - {}", req.method, req.path, res.status);
+    }
 }
 
 
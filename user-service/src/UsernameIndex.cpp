@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <mutex>
+#include "UsernameIndex.h"
+
+using namespace std;
+
+struct UsernameIndex::Node {
+    string label;                      // characters on the edge from the parent
+    vector<unique_ptr<Node>> children; // sorted by label[0] - labels of siblings never share it
+    vector<Suggestion> entries;        // users whose normalized name ends exactly here, by id
+};
+
+UsernameIndex::UsernameIndex() : mRoot(make_unique<Node>()) {}
+UsernameIndex::~UsernameIndex() = default;
+
+string UsernameIndex::normalize(const string& pUsername){
+    size_t lFirst = pUsername.find_first_not_of(" \t");
+    if(lFirst == string::npos) return "";
+    size_t lLast = pUsername.find_last_not_of(" \t");
+    string lKey = pUsername.substr(lFirst, lLast - lFirst + 1);
+    for(char& c : lKey){
+        if(c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a'); // ASCII only - what SQLite's NOCASE does
+    }
+    return lKey;
+}
+
+void UsernameIndex::insert(const string& pUsername, int pId){
+    string lKey = normalize(pUsername);
+    unique_lock<shared_mutex> lLock(mMutex);
+
+    Node* lNode = mRoot.get();
+    size_t lPos = 0;
+    while(lPos < lKey.size()){
+        auto lIt = lower_bound(lNode->children.begin(), lNode->children.end(), lKey[lPos],
+            [](const unique_ptr<Node>& c, char pFirst){ return (unsigned char)c->label[0] < (unsigned char)pFirst; });
+        if(lIt == lNode->children.end() || (*lIt)->label[0] != lKey[lPos]){
+            // nothing shares this character: the rest of the key becomes one new edge
+            unique_ptr<Node> lLeaf = make_unique<Node>();
+            lLeaf->label = lKey.substr(lPos);
+            lNode = lNode->children.insert(lIt, move(lLeaf))->get();
+            ++mNodeCount;
+            break;
+        }
+
+        Node& lChild = **lIt;
+        size_t lCommon = 0;
+        while(lCommon < lChild.label.size() && lPos + lCommon < lKey.size() && lChild.label[lCommon] == lKey[lPos + lCommon]){
+            ++lCommon;
+        }
+        if(lCommon < lChild.label.size()){
+            // the key leaves this edge half way: split it at the divergence point
+            unique_ptr<Node> lMiddle = make_unique<Node>();
+            lMiddle->label = lChild.label.substr(0, lCommon);
+            lChild.label.erase(0, lCommon);
+            lMiddle->children.push_back(move(*lIt));
+            *lIt = move(lMiddle);
+            ++mNodeCount;
+        }
+        lNode = lIt->get();
+        lPos += lCommon;
+    }
+
+    auto lEntry = lower_bound(lNode->entries.begin(), lNode->entries.end(), pId,
+                              [](const Suggestion& e, int pValue){ return e.id < pValue; });
+    if(lEntry != lNode->entries.end() && lEntry->id == pId) return;
+    lNode->entries.insert(lEntry, Suggestion{pId, pUsername});
+    ++mSize;
+}
+
+vector<UsernameIndex::Suggestion> UsernameIndex::suggest(const string& pPrefix, size_t pLimit) const{
+    string lKey = normalize(pPrefix);
+    vector<Suggestion> lOut;
+    if(pLimit == 0) return lOut;
+    shared_lock<shared_mutex> lLock(mMutex);
+
+    const Node* lNode = mRoot.get();
+    size_t lPos = 0;
+    while(lPos < lKey.size()){
+        auto lIt = lower_bound(lNode->children.begin(), lNode->children.end(), lKey[lPos],
+            [](const unique_ptr<Node>& c, char pFirst){ return (unsigned char)c->label[0] < (unsigned char)pFirst; });
+        if(lIt == lNode->children.end() || (*lIt)->label[0] != lKey[lPos]) return lOut;
+
+        const string& lLabel = (*lIt)->label;
+        size_t lRemaining = lKey.size() - lPos;
+        if(lLabel.size() >= lRemaining){
+            // the prefix ends inside (or at the end of) this edge - everything below matches
+            if(lLabel.compare(0, lRemaining, lKey, lPos, lRemaining) != 0) return lOut;
+            lNode = lIt->get();
+            break;
+        }
+        if(lKey.compare(lPos, lLabel.size(), lLabel) != 0) return lOut;
+        lNode = lIt->get();
+        lPos += lLabel.size();
+    }
+    collect(*lNode, pLimit, lOut);
+    return lOut;
+}
+
+// pre-order: a node's own names before its children's, so shorter completions come first
+void UsernameIndex::collect(const Node& pNode, size_t pLimit, vector<Suggestion>& pOut){
+    for(const Suggestion& lEntry : pNode.entries){
+        if(pOut.size() >= pLimit) return;
+        pOut.push_back(lEntry);
+    }
+    for(const unique_ptr<Node>& lChild : pNode.children){
+        if(pOut.size() >= pLimit) return;
+        collect(*lChild, pLimit, pOut);
+    }
+}
+
+size_t UsernameIndex::size() const{
+    shared_lock<shared_mutex> lLock(mMutex);
+    return mSize;
+}
+
+size_t UsernameIndex::nodeCount() const{
+    shared_lock<shared_mutex> lLock(mMutex);
+    return mNodeCount;
+}
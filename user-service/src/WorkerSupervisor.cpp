@@ -0,0 +1,174 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+#include <cstring>
+#include <unistd.h>   // fork, sleep
+#include <sys/wait.h> // waitpid
+#ifdef __linux__
+#include <sys/prctl.h> // PR_SET_PDEATHSIG
+#endif
+#include "WorkerSupervisor.h"
+
+using namespace std;
+
+// initialize static members
+volatile sig_atomic_t WorkerSupervisor::sShutdownSignal = 0;
+volatile pid_t WorkerSupervisor::sWorkerPids[WorkerSupervisor::MAX_WORKERS] = {};
+
+WorkerSupervisor::WorkerSupervisor(int pWorkerCount, WorkerMain pWorkerMain){
+    if(pWorkerCount < 1 || pWorkerCount > MAX_WORKERS){
+        throw invalid_argument("--workers must be between 1 and " + to_string(MAX_WORKERS));
+    }
+    mWorkerCount = pWorkerCount;
+    mWorkerMain = move(pWorkerMain);
+    mWorkerPids.assign(mWorkerCount, 0);
+    mWorkerStartTimes.assign(mWorkerCount, 0);
+    mCrashCounts.assign(mWorkerCount, 0);
+}
+
+// Runs inside the signal handler: only sets a flag and calls kill(), both async-signal-safe.
+// Forwarding from here (instead of from the main loop) means a signal can never get lost
+// between checking the flag and blocking in waitpid().
+void WorkerSupervisor::handleShutdownSignal(int pSigNum){
+    sShutdownSignal = pSigNum;
+    for(int i = 0; i < MAX_WORKERS; ++i){
+        pid_t lPid = sWorkerPids[i];
+        if(lPid > 0) kill(lPid, SIGTERM);
+    }
+}
+
+pid_t WorkerSupervisor::spawnWorker(int pWorkerIndex){
+    // flush buffered output, otherwise the child inherits (and prints again) whatever is pending
+    cout.flush();
+    cerr.flush();
+
+    pid_t lPid = fork();
+    if(lPid < 0){
+        throw runtime_error("fork() failed: " + string(strerror(errno)));
+    }
+
+    if(lPid == 0){
+        // ---- child ----
+        // drop the supervisor's handlers, the worker installs its own (stop server on SIGINT/SIGTERM)
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+#ifdef __linux__
+        // if the supervisor dies (e.g. SIGKILL), don't leave orphaned workers holding the port
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        int lExitCode = 1;
+        try{
+            lExitCode = mWorkerMain(pWorkerIndex);
+        }
+        catch(const exception& e){
+            cerr<<"Worker "<<pWorkerIndex<<" failed: "<<e.what()<<endl;
+        }
+        exit(lExitCode);
+    }
+
+    // ---- parent ----
+    mWorkerPids[pWorkerIndex] = lPid;
+    mWorkerStartTimes[pWorkerIndex] = time(nullptr);
+    sWorkerPids[pWorkerIndex] = lPid;
+    cout<<"Started worker "<<pWorkerIndex<<" (pid "<<lPid<<")"<<endl;
+    return lPid;
+}
+
+int WorkerSupervisor::workerIndexOf(pid_t pPid) const{
+    auto lIt = find(mWorkerPids.begin(), mWorkerPids.end(), pPid);
+    return (lIt == mWorkerPids.end()) ? -1 : (int)(lIt - mWorkerPids.begin());
+}
+
+int WorkerSupervisor::run(){
+    // No SA_RESTART: a signal must interrupt waitpid() so the loop notices the shutdown
+    struct sigaction lAction;
+    memset(&lAction, 0, sizeof(lAction));
+    lAction.sa_handler = WorkerSupervisor::handleShutdownSignal;
+    sigemptyset(&lAction.sa_mask);
+    sigaction(SIGINT, &lAction, nullptr);
+    sigaction(SIGTERM, &lAction, nullptr);
+
+    for(int i = 0; i < mWorkerCount && !sShutdownSignal; ++i){
+        spawnWorker(i);
+    }
+
+    // Supervise: block until a child exits, restart it unless we are shutting down
+    while(!sShutdownSignal){
+        int lStatus = 0;
+        pid_t lPid = waitpid(-1, &lStatus, 0);
+        if(lPid < 0){
+            if(errno == EINTR) continue; // signal received - loop condition decides
+            break;                       // ECHILD - nothing left to supervise
+        }
+
+        int lIndex = workerIndexOf(lPid);
+        if(lIndex < 0) continue;
+        mWorkerPids[lIndex] = 0;
+        sWorkerPids[lIndex] = 0;
+
+        if(WIFSIGNALED(lStatus)){
+            cerr<<"Worker "<<lIndex<<" (pid "<<lPid<<") killed by signal "<<WTERMSIG(lStatus)<<endl;
+        }
+        else{
+            cerr<<"Worker "<<lIndex<<" (pid "<<lPid<<") exited with code "<<WEXITSTATUS(lStatus)<<endl;
+        }
+        if(sShutdownSignal) break;
+
+        // A worker that dies right after start (bad port, DB locked, ...) would otherwise be
+        // respawned in a tight fork loop - back off 1s, 2s, ... up to 10s.
+        if(time(nullptr) - mWorkerStartTimes[lIndex] < 5){
+            mCrashCounts[lIndex] = min(mCrashCounts[lIndex] + 1, 10);
+            sleep(mCrashCounts[lIndex]); // returns early if a signal arrives
+        }
+        else{
+            mCrashCounts[lIndex] = 0;
+        }
+        if(!sShutdownSignal) spawnWorker(lIndex);
+    }
+
+    stopWorkers();
+    return 0;
+}
+
+// Forward the shutdown to every worker and wait for them to drain. Workers still alive after the
+// grace period are killed.
+void WorkerSupervisor::stopWorkers(){
+    cout<<"Shutting down "<<mWorkerCount<<" worker(s) gracefully..."<<endl;
+    for(int i = 0; i < mWorkerCount; ++i){
+        if(mWorkerPids[i] > 0) kill(mWorkerPids[i], SIGTERM);
+    }
+
+    time_t lDeadline = time(nullptr) + SHUTDOWN_GRACE_SECONDS;
+    auto lAliveCount = [this](){
+        return count_if(mWorkerPids.begin(), mWorkerPids.end(), [](pid_t p){ return p > 0; });
+    };
+
+    while(lAliveCount() > 0){
+        int lStatus = 0;
+        pid_t lPid = waitpid(-1, &lStatus, WNOHANG);
+        if(lPid > 0){
+            int lIndex = workerIndexOf(lPid);
+            if(lIndex >= 0){
+                mWorkerPids[lIndex] = 0;
+                sWorkerPids[lIndex] = 0;
+            }
+            continue;
+        }
+        if(lPid < 0 && errno != EINTR) break; // ECHILD
+
+        if(time(nullptr) >= lDeadline){
+            for(int i = 0; i < mWorkerCount; ++i){
+                if(mWorkerPids[i] > 0){
+                    cerr<<"Worker "<<i<<" (pid "<<mWorkerPids[i]<<") did not stop in time, killing it"<<endl;
+                    kill(mWorkerPids[i], SIGKILL);
+                }
+            }
+            lDeadline = time(nullptr) + SHUTDOWN_GRACE_SECONDS; // reap the killed workers
+        }
+        usleep(100 * 1000);
+    }
+    cout<<"All workers stopped."<<endl;
+}
@@ -5,8 +5,16 @@
 #include <ctime>
 #include <csignal>    // for signal handling
 #include <filesystem> // C++17 feature - to deal with directories
+#include <map>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <unistd.h>   // getpid
+#include <sys/socket.h>
 #include "UserService.h"
 #include "Logger.h"
+#include "WorkerSupervisor.h"
 
 using namespace std;
 using namespace httplib;
@@ -15,12 +23,16 @@ using json = nlohmann::json;
 
 // Global variable
 unique_ptr<Server> gServer; // global server object so that its accessbile for signal handler
+// --capture: one pseudonym key for the whole run, created before fork() so every worker's
+// capture file (and a restarted worker's) maps a given email to the same pseudonym
+string gCapturePseudonymKey;
 
 void signalHandler(int pSigNum){
     switch(pSigNum){
-        case SIGINT: {
+        case SIGINT:
+        case SIGTERM: { // SIGTERM: sent by docker/k8s on stop, and by the supervisor in --workers mode
             cout<<"Interrupt Singal("<<pSigNum<<") received, Shutting down server gracefully..."<<endl;
-            if(gServer) gServer->stop();
+            if(gServer) gServer->stop(); // stops accepting; in-flight requests are drained before listen() returns
         }
         break;
         default: {
@@ -44,21 +56,206 @@ void createDirectoryStructure(string& pPath){
     }
 }
 
+// Splits command line into positional arguments and "--name value" options
+// e.g. ./user_service data/user_db.db 2 8001 --workers 4
+void parseArguments(int argc, char* argv[], vector<string>& pPositional, map<string, string>& pOptions){
+    for(int i = 1; i < argc; ++i){ // first argument is always program's name
+        string lArg(argv[i]);
+        if(lArg.rfind("--", 0) == 0){
+            if(i + 1 >= argc){
+                throw invalid_argument("Missing value for option " + lArg);
+            }
+            pOptions[lArg.substr(2)] = argv[++i];
+        }
+        else{
+            pPositional.push_back(lArg);
+        }
+    }
+}
+
+// "64M" -> 67108864; plain numbers are bytes, K/M/G suffixes are powers of 1024
+uint64_t parseByteSize(const string& pValue){
+    size_t lDigits = 0;
+    uint64_t lValue = stoull(pValue, &lDigits);
+    string lSuffix = pValue.substr(lDigits);
+    if(lSuffix.empty()) return lValue;
+    switch(toupper(lSuffix[0])){
+        case 'K': return lValue << 10;
+        case 'M': return lValue << 20;
+        case 'G': return lValue << 30;
+    }
+    throw invalid_argument("Invalid size: " + pValue);
+}
+
+// Creates the server + service and blocks in listen() until a shutdown signal arrives.
+// In --workers mode every worker process runs this independently: own server, own sqlite3
+// connection, own log file - only the listening port (SO_REUSEPORT) and the DB file are shared.
+int runServer(const string& pDBPath, string& pLogPath, LOG_LEVEL pLogLevel, int pPort, bool pReusePort,
+              map<string, string>& pOptions){
+    // Initialize the global server object
+    gServer = make_unique<Server>();
+    if(!gServer){
+        throw runtime_error("Error while creating server instance.");
+    }
+    // Without TCP_NODELAY every keep-alive request after the first waited ~40ms: Nagle held back
+    // the response's last segment until the client's delayed ACK arrived
+    gServer->set_tcp_nodelay(true);
+    if(pReusePort){
+        // Every worker binds the same ip:port - the kernel then load-balances accepts across them
+        gServer->set_socket_options([](socket_t pSock){
+            int lOn = 1;
+            setsockopt(pSock, SOL_SOCKET, SO_REUSEADDR, &lOn, sizeof(lOn));
+#ifdef SO_REUSEPORT
+            setsockopt(pSock, SOL_SOCKET, SO_REUSEPORT, &lOn, sizeof(lOn));
+#endif
+        });
+    }
+
+    // Register Signal Handler for SIGINT/SIGTERM
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    // level first, so that the service/database startup messages already honour it
+    shared_ptr<FileLogger> lLogger = FileLogger::getInstance(pLogPath);
+    lLogger->setLogLevel(pLogLevel);
+    // --log-mono on: add a steady-clock offset (seconds since start) next to every timestamp
+    if(pOptions.count("log-mono")){
+        lLogger->setMonotonicOffsets(pOptions["log-mono"] != "off");
+    }
+    // --log-rotate-size 64M / --log-rotate-interval <seconds>: start a new segment when either is hit
+    if(pOptions.count("log-rotate-size") || pOptions.count("log-rotate-interval")){
+        LogRotationPolicy lPolicy;
+        if(pOptions.count("log-rotate-size")) lPolicy.maxBytes = parseByteSize(pOptions["log-rotate-size"]);
+        if(pOptions.count("log-rotate-interval")) lPolicy.interval = chrono::seconds(stol(pOptions["log-rotate-interval"]));
+        if(pOptions.count("log-keep")) lPolicy.keepSegments = stoi(pOptions["log-keep"]);
+        lPolicy.compress = pOptions.count("log-compress") && pOptions["log-compress"] != "off";
+        lLogger->enableRotation(lPolicy);
+    }
+    // --log-format binary: format id + raw arguments per line, decode with user_service_logdecode
+    if(pOptions.count("log-format") && pOptions["log-format"] == "binary"){
+        lLogger->enableBinary();
+    }
+    unique_ptr<UserService> lUserService = make_unique<UserService>(pDBPath, pLogPath);
+    // --log-async <ring capacity>: log lines are written by a background thread
+    if(pOptions.count("log-async")){
+        LogOverflowPolicy lPolicy = LogOverflowPolicy::DROP;
+        if(pOptions.count("log-overflow") && pOptions["log-overflow"] == "block"){
+            lPolicy = LogOverflowPolicy::BLOCK;
+        }
+        lLogger->enableAsync(stoul(pOptions["log-async"]), lPolicy);
+    }
+    if(pOptions.count("server-timing")){
+        lUserService->setServerTiming(pOptions["server-timing"] != "off");
+    }
+    if(pOptions.count("max-queue-ms")){
+        lUserService->setMaxQueueWait(chrono::milliseconds(stoi(pOptions["max-queue-ms"])));
+    }
+    // e.g. --route-limits "POST /users=4,GET /users/{id}=64"
+    if(pOptions.count("route-limits")){
+        stringstream lLimits(pOptions["route-limits"]);
+        string lEntry;
+        while(getline(lLimits, lEntry, ',')){
+            size_t lEquals = lEntry.rfind('=');
+            if(lEquals == string::npos){
+                throw invalid_argument("Invalid --route-limits entry: " + lEntry);
+            }
+            lUserService->setConcurrencyLimit(lEntry.substr(0, lEquals), stoi(lEntry.substr(lEquals + 1)));
+        }
+    }
+
+    // e.g. --log-sample "GET /health=1/100,GET /users/{id}=200/s,GET /users/{id} 4xx=1/10"
+    if(pOptions.count("log-sample")){
+        stringstream lRules(pOptions["log-sample"]);
+        string lEntry;
+        while(getline(lRules, lEntry, ',')){
+            size_t lEquals = lEntry.rfind('=');
+            if(lEquals == string::npos){
+                throw invalid_argument("Invalid --log-sample entry: " + lEntry);
+            }
+            lUserService->setAccessLogSampling(lEntry.substr(0, lEquals), lEntry.substr(lEquals + 1));
+        }
+    }
+    if(pOptions.count("log-slow-ms")){
+        lUserService->setSlowRequestLogThreshold(chrono::milliseconds(stol(pOptions["log-slow-ms"])));
+    }
+    // --capture <file>: sanitized requests as JSON lines, replay them with user_service_replay
+    if(pOptions.count("capture")){
+        string lCapturePath = pOptions["capture"];
+        if(pReusePort) lCapturePath += "." + to_string(getpid()); // one file per worker
+        lUserService->setCapture(make_shared<RequestCapture>(lCapturePath, gCapturePseudonymKey));
+    }
+    // --admin-token <t> (or USER_SERVICE_ADMIN_TOKEN, which stays out of `ps`): enables /admin/export
+    const char* lAdminToken = getenv("USER_SERVICE_ADMIN_TOKEN");
+    if(pOptions.count("admin-token")) lUserService->setAdminToken(pOptions["admin-token"]);
+    else if(lAdminToken) lUserService->setAdminToken(lAdminToken);
+
+    const char* lDockerEnv = getenv("DOCKER_ENV");
+    string lIPAddress = "localhost"; // OR 127.0.0.1 - listen to requests coming from this very machine
+    if(lDockerEnv && lDockerEnv == string("TRUE")) lIPAddress = "0.0.0.0"; // special IP address for "listen on all interfaces"
+
+    lUserService->setupRoutes(*gServer); // Pass the dereferenced global server
+
+    // --prewarm on: warm the database before listening; background: listen right away and
+    // answer GET /ready with 503 until the warmup is done
+    string lPrewarm = pOptions.count("prewarm") ? pOptions["prewarm"] : "off";
+    thread lWarmupThread;
+    if(lPrewarm == "on"){
+        lUserService->warmUp();
+    }
+    else if(lPrewarm == "background"){
+        lUserService->setReady(false);
+        lWarmupThread = thread([&lUserService, lLogger]{
+            // An exception leaving a thread would std::terminate the server. Warming is only an
+            // optimization, so a failed one still reports ready: the instance serves cold, and a
+            // database that is really broken shows up as failing requests. Staying 503 instead
+            // would keep a live process out of rotation for good - /ready never restarts it.
+            // (--prewarm on still fails the startup: nothing is serving yet, exiting is cheap.)
+            try{
+                lUserService->warmUp();
+            }
+            catch(const exception& e){
+                LOG_ERROR(lLogger, "Prewarm failed, serving cold: {}", e.what());
+                lUserService->setReady(true);
+            }
+        });
+    }
+    else if(lPrewarm != "off"){
+        throw invalid_argument("--prewarm must be off, on or background");
+    }
+
+    cout<<"User Service (pid "<<getpid()<<") started on http://"<<lIPAddress<<":"<<pPort<<", press Ctrl+C to stop..."<<endl;
+    bool lListened = gServer->listen(lIPAddress, pPort);
+    if(lWarmupThread.joinable()) lWarmupThread.join();
+    if(!lListened){
+        cerr<<"Failed to listen on "<<lIPAddress<<":"<<pPort<<endl;
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]){
     try{
-        if(argc < 2){
-            throw invalid_argument("Usage: ./user_service <db_path> [loglevel] [port]");
-        }
-        string lDBPath(argv[1]); // first argument is always program's name
-        
-        // Initialize the global server object
-        gServer = make_unique<Server>();
-        if(!gServer){
-            throw runtime_error("Error while creating server instance.");
+        vector<string> lArgs;
+        map<string, string> lOptions;
+        parseArguments(argc, argv, lArgs, lOptions);
+        if(lArgs.empty()){
+            throw invalid_argument("Usage: ./user_service <db_path> [loglevel] [port] [--workers N] [--server-timing on|off] [--max-queue-ms N] [--route-limits \"METHOD route=N,...\"] [--log-async N] [--log-overflow drop|block] [--log-mono on|off] [--log-format text|binary] [--log-rotate-size N[K|M|G]] [--log-rotate-interval S] [--log-keep N] [--log-compress on|off] [--log-sample \"METHOD route[ Nxx]=1/N|R/s,...\"] [--log-slow-ms N] [--capture <file>] [--prewarm off|on|background] [--admin-token T]");
         }
+        string lDBPath(lArgs[0]);
 
-        // Register Signal Handler for SIGINT
-        signal(SIGINT, signalHandler);
+        LOG_LEVEL lLogLevel = LOG_LEVEL::ERROR;
+        if(lArgs.size() >= 2){
+            lLogLevel = (LOG_LEVEL)(stoi(lArgs[1]));
+        }
+        // create server to start listening
+        int lPort = 8001;
+        if(lArgs.size() >= 3){
+            lPort = stoi(lArgs[2]);
+        }
+        int lWorkers = 0; // 0 = classic single process mode
+        if(lOptions.count("workers")){
+            lWorkers = stoi(lOptions["workers"]);
+        }
 
         // generate new file for each run and with unique log file name
         time_t lCurrTime = time(0);
@@ -68,27 +265,25 @@ int main(int argc, char* argv[]){
         createDirectoryStructure(lDBPath);
         createDirectoryStructure(lLogPath);
 
-        unique_ptr<UserService> lUserService = make_unique<UserService>(lDBPath, lLogPath);
-        shared_ptr<FileLogger> lLogger = FileLogger::getInstance(lLogPath);
-
-        LOG_LEVEL lLogLevel = LOG_LEVEL::ERROR;
-        if(argc == 3){
-            lLogLevel = (LOG_LEVEL)(stoi(argv[2]));
-            lLogger->setLogLevel(lLogLevel);
+        if(lOptions.count("capture")){
+            gCapturePseudonymKey = RequestCapture::newPseudonymKey();
         }
-        // create server to start listening
-        int lPort = 8001;
-        if(argc == 4){
-            lPort = stoi(argv[3]);
+
+        if(lWorkers == 0){
+            return runServer(lDBPath, lLogPath, lLogLevel, lPort, false, lOptions);
         }
 
-        const char* lDockerEnv = getenv("DOCKER_ENV");
-        string lIPAddress = "localhost"; // OR 127.0.0.1 - listen to requests coming from this very machine
-        if(lDockerEnv && lDockerEnv == string("TRUE")) lIPAddress = "0.0.0.0"; // special IP address for "listen on all interfaces"
+        // Pre-fork mode: create the schema and switch the file to WAL once, in the parent, so the
+        // workers don't race on it. The connection is closed again before fork() - SQLite
+        // connections must never be carried across a fork.
+        { Database lSchemaInit(lDBPath); }
 
-        lUserService->setupRoutes(*gServer); // Pass the dereferenced global server
-        cout<<"User Service started on http://"<<lIPAddress<<":"<<lPort<<", press Ctrl+C to stop..."<<endl;
-        gServer->listen(lIPAddress, lPort); 
+        WorkerSupervisor lSupervisor(lWorkers, [&](int pWorkerIndex){
+            // one log file per worker - FileLogger is a per-process singleton
+            string lWorkerLogPath = "./logs/user_service_" + to_string(lCurrTime) + "_w" + to_string(pWorkerIndex) + ".txt";
+            return runServer(lDBPath, lWorkerLogPath, lLogLevel, lPort, true, lOptions);
+        });
+        return lSupervisor.run();
     }
     catch(const invalid_argument& e){
         cerr<<"Error: "<<e.what()<<endl;
@@ -102,4 +297,5 @@ int main(int argc, char* argv[]){
 }
 
 
-// ./user_service ../data/user_db.db 2
\ No newline at end of file
+// ./user_service ../data/user_db.db 2
+// ./user_service ../data/user_db.db 2 8001 --workers 4
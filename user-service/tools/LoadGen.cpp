@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>   // getpid
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+#include "Metrics.h"
+
+using namespace std;
+using json = nlohmann::json;
+using Clock = chrono::steady_clock;
+
+// Open-loop HTTP load generator for user_service.
+//
+//   ./user_service_loadgen [--host localhost] [--port 8001] [--rate 500] [--duration 10]
+//                          [--connections 16] [--mix "get=70,multi-get=10,signup=5,health=15"]
+//                          [--seed 100] [--users 1000] [--multi-get 5] [--json]
+//
+// Open loop (--rate > 0): request i is *due* at start + i / rate, whether or not earlier requests
+// have finished - like real users, who don't wait for each other. Latency is measured from the
+// due time, so when the server stalls, the requests that queue up behind the stall are charged
+// for it. A closed-loop tool (send, wait, send) would simply send less during the stall and
+// report a fine p99 - "coordinated omission". Service time (from the moment the request was
+// actually sent) is reported too; a big gap between the two means requests were queueing.
+// --rate 0 runs closed loop: every connection sends back-to-back for --duration seconds.
+
+enum Scenario { SIGNUP, GET, MULTI_GET, HEALTH, SCENARIO_COUNT };
+static const char* sScenarioNames[SCENARIO_COUNT] = {"signup", "get", "multi-get", "health"};
+
+struct Options {
+    string host = "localhost";
+    int port = 8001;
+    double rate = 500;            // requests per second, 0 = closed loop
+    double durationSec = 10;
+    int connections = 16;
+    int weights[SCENARIO_COUNT] = {5, 70, 10, 15};
+    int seedUsers = 0;            // signups before the measured run, their ids are used by gets
+    int users = 1000;             // without seeding: gets pick ids from [1, users]
+    int multiGet = 5;             // GETs per multi-get operation
+    bool json = false;
+};
+
+struct ScenarioStats {
+    LatencyHistogram responseTime; // from the due time - includes waiting for a free connection
+    LatencyHistogram serviceTime;  // from the moment the request was actually sent
+    atomic<uint64_t> count{0};
+    atomic<uint64_t> success{0};   // 2xx/3xx
+    atomic<uint64_t> notFound{0};  // 404 - expected for gets of ids that don't exist
+    atomic<uint64_t> rejected{0};  // 503 - shed by admission control
+    atomic<uint64_t> failed{0};    // other statuses and transport errors
+};
+
+static void parseMix(const string& pMix, int pWeights[SCENARIO_COUNT]){
+    fill(pWeights, pWeights + SCENARIO_COUNT, 0);
+    stringstream lStream(pMix);
+    string lEntry;
+    while(getline(lStream, lEntry, ',')){
+        size_t lEquals = lEntry.find('=');
+        string lName = lEntry.substr(0, lEquals);
+        auto lIt = find_if(begin(sScenarioNames), end(sScenarioNames), [&](const char* n){ return lName == n; });
+        if(lEquals == string::npos || lIt == end(sScenarioNames)){
+            throw invalid_argument("Invalid --mix entry: " + lEntry);
+        }
+        pWeights[lIt - begin(sScenarioNames)] = stoi(lEntry.substr(lEquals + 1));
+    }
+}
+
+static Options parseOptions(int argc, char* argv[]){
+    Options lOptions;
+    for(int i = 1; i < argc; ++i){
+        string lArg = argv[i];
+        if(lArg == "--json"){ lOptions.json = true; continue; }
+        if(i + 1 >= argc) throw invalid_argument("Missing value for option " + lArg);
+        string lValue = argv[++i];
+        if(lArg == "--host") lOptions.host = lValue;
+        else if(lArg == "--port") lOptions.port = stoi(lValue);
+        else if(lArg == "--rate") lOptions.rate = stod(lValue);
+        else if(lArg == "--duration") lOptions.durationSec = stod(lValue);
+        else if(lArg == "--connections") lOptions.connections = max(1, stoi(lValue));
+        else if(lArg == "--mix") parseMix(lValue, lOptions.weights);
+        else if(lArg == "--seed") lOptions.seedUsers = stoi(lValue);
+        else if(lArg == "--users") lOptions.users = max(1, stoi(lValue));
+        else if(lArg == "--multi-get") lOptions.multiGet = max(1, stoi(lValue));
+        else throw invalid_argument("Unknown option " + lArg);
+    }
+    return lOptions;
+}
+
+// splitmix64 - request i always gets the same scenario/user id, so runs are repeatable
+static uint64_t mix64(uint64_t pValue){
+    pValue += 0x9e3779b97f4a7c15ull;
+    pValue = (pValue ^ (pValue >> 30)) * 0xbf58476d1ce4e5b9ull;
+    pValue = (pValue ^ (pValue >> 27)) * 0x94d049bb133111ebull;
+    return pValue ^ (pValue >> 31);
+}
+
+class LoadGenerator{
+    Options mOptions;
+    ScenarioStats mStats[SCENARIO_COUNT];
+    int mTotalWeight = 0;
+    int mFirstUserId = 1;
+    int mUserCount = 1;
+    atomic<uint64_t> mNextRequest{0};
+    string mRunTag = to_string(getpid()) + "_" + to_string(time(nullptr)); // unique signup emails
+
+    public:
+        explicit LoadGenerator(const Options& pOptions) : mOptions(pOptions){
+            for(int w : mOptions.weights) mTotalWeight += w;
+            if(mTotalWeight <= 0) throw invalid_argument("--mix has no scenario with a weight > 0");
+            mUserCount = mOptions.users;
+        }
+
+        void seed(){
+            if(mOptions.seedUsers <= 0) return;
+            httplib::Client lClient(mOptions.host, mOptions.port);
+            int lFirst = -1, lLast = -1;
+            for(int i = 0; i < mOptions.seedUsers; ++i){
+                int lId = signup(lClient, "seed_" + mRunTag + "_" + to_string(i));
+                if(lId < 0) continue;
+                if(lFirst < 0) lFirst = lId;
+                lLast = lId;
+            }
+            if(lFirst < 0) throw runtime_error("seeding failed - is the service running on " + mOptions.host + ":" + to_string(mOptions.port) + "?");
+            mFirstUserId = lFirst;
+            mUserCount = lLast - lFirst + 1;
+        }
+
+        double run(){
+            vector<thread> lThreads;
+            Clock::time_point lStart = Clock::now() + chrono::milliseconds(50); // let every thread get ready
+            for(int c = 0; c < mOptions.connections; ++c){
+                lThreads.emplace_back(&LoadGenerator::connectionLoop, this, lStart);
+            }
+            for(thread& lThread : lThreads) lThread.join();
+            return chrono::duration<double>(Clock::now() - lStart).count();
+        }
+
+        void report(double pElapsedSec) const;
+
+    private:
+        Scenario scenarioFor(uint64_t pRequest) const{
+            int lPick = (int)(mix64(pRequest) % (uint64_t)mTotalWeight);
+            for(int s = 0; s < SCENARIO_COUNT; ++s){
+                if(lPick < mOptions.weights[s]) return (Scenario)s;
+                lPick -= mOptions.weights[s];
+            }
+            return HEALTH;
+        }
+
+        int userIdFor(uint64_t pRequest, int pIndex) const{
+            return mFirstUserId + (int)(mix64(pRequest * 31 + pIndex + 1) % (uint64_t)mUserCount);
+        }
+
+        static httplib::Result postSignup(httplib::Client& pClient, const string& pName){
+            json lBody = {{"username", pName}, {"email", pName + "@example.com"}, {"password", "L0adgen!" + pName}};
+            return pClient.Post("/users", lBody.dump(), "application/json");
+        }
+
+        // returns the new user's id, -1 on failure
+        static int signup(httplib::Client& pClient, const string& pName){
+            httplib::Result lResult = postSignup(pClient, pName);
+            if(!lResult || lResult->status != 201) return -1;
+            json lResponse = json::parse(lResult->body, nullptr, false);
+            if(lResponse.is_discarded() || !lResponse.contains("data")) return -1;
+            const json& lId = lResponse["data"];
+            return lId.is_string() ? stoi(lId.get<string>()) : lId.get<int>();
+        }
+
+        void connectionLoop(Clock::time_point pStart){
+            httplib::Client lClient(mOptions.host, mOptions.port);
+            lClient.set_keep_alive(true);
+            lClient.set_tcp_nodelay(true); // otherwise Nagle + delayed ACKs add ~40ms to small requests
+            bool lOpenLoop = mOptions.rate > 0;
+            uint64_t lTotal = lOpenLoop ? (uint64_t)(mOptions.rate * mOptions.durationSec) : UINT64_MAX;
+            Clock::time_point lEnd = pStart + chrono::duration_cast<Clock::duration>(chrono::duration<double>(mOptions.durationSec));
+
+            this_thread::sleep_until(pStart);
+            for(;;){
+                uint64_t lRequest = mNextRequest.fetch_add(1, memory_order_relaxed);
+                if(lRequest >= lTotal) break;
+
+                Clock::time_point lDue;
+                if(lOpenLoop){
+                    lDue = pStart + chrono::duration_cast<Clock::duration>(chrono::duration<double>(lRequest / mOptions.rate));
+                    this_thread::sleep_until(lDue); // returns at once when we're already behind
+                }
+                else{
+                    lDue = Clock::now();
+                    if(lDue >= lEnd) break;
+                }
+
+                Scenario lScenario = scenarioFor(lRequest);
+                Clock::time_point lSent = Clock::now();
+                int lStatus = execute(lClient, lScenario, lRequest);
+                Clock::time_point lDone = Clock::now();
+
+                ScenarioStats& lStats = mStats[lScenario];
+                lStats.responseTime.recordDuration(lDone - lDue);
+                lStats.serviceTime.recordDuration(lDone - lSent);
+                lStats.count.fetch_add(1, memory_order_relaxed);
+                if(lStatus >= 200 && lStatus < 400) lStats.success.fetch_add(1, memory_order_relaxed);
+                else if(lStatus == 404) lStats.notFound.fetch_add(1, memory_order_relaxed);
+                else if(lStatus == 503) lStats.rejected.fetch_add(1, memory_order_relaxed);
+                else lStats.failed.fetch_add(1, memory_order_relaxed);
+            }
+        }
+
+        // returns the HTTP status (the worst one for multi-get), 0 on a transport error
+        int execute(httplib::Client& pClient, Scenario pScenario, uint64_t pRequest){
+            switch(pScenario){
+                case SIGNUP:
+                    return status(postSignup(pClient, "lg_" + mRunTag + "_" + to_string(pRequest)));
+                case GET:
+                    return status(pClient.Get("/users/" + to_string(userIdFor(pRequest, 0))));
+                case MULTI_GET: {
+                    int lWorst = 200;
+                    for(int i = 0; i < mOptions.multiGet; ++i){
+                        int lStatus = status(pClient.Get("/users/" + to_string(userIdFor(pRequest, i))));
+                        if(lStatus == 0 || lStatus > lWorst) lWorst = lStatus;
+                        if(lStatus == 0) break;
+                    }
+                    return lWorst;
+                }
+                case HEALTH:
+                default:
+                    return status(pClient.Get("/health"));
+            }
+        }
+
+        static int status(const httplib::Result& pResult){
+            return pResult ? pResult->status : 0;
+        }
+};
+
+static json histogramJson(const LatencyHistogram::Snapshot& pSnapshot){
+    return {
+        {"p50_us", pSnapshot.quantileMicros(0.5)},
+        {"p90_us", pSnapshot.quantileMicros(0.9)},
+        {"p99_us", pSnapshot.quantileMicros(0.99)},
+        {"p999_us", pSnapshot.quantileMicros(0.999)},
+        {"mean_us", pSnapshot.count ? (double)pSnapshot.sumMicros / pSnapshot.count : 0.0}
+    };
+}
+
+void LoadGenerator::report(double pElapsedSec) const{
+    uint64_t lTotal = 0;
+    json lScenarios = json::object();
+    for(int s = 0; s < SCENARIO_COUNT; ++s){
+        const ScenarioStats& lStats = mStats[s];
+        if(lStats.count == 0) continue;
+        lTotal += lStats.count;
+        lScenarios[sScenarioNames[s]] = {
+            {"count", lStats.count.load()},
+            {"success", lStats.success.load()},
+            {"not_found", lStats.notFound.load()},
+            {"rejected_503", lStats.rejected.load()},
+            {"failed", lStats.failed.load()},
+            {"response_time", histogramJson(lStats.responseTime.snapshot())},
+            {"service_time", histogramJson(lStats.serviceTime.snapshot())}
+        };
+    }
+    double lThroughput = lTotal / pElapsedSec;
+
+    if(mOptions.json){
+        json lReport = {
+            {"config", {
+                {"host", mOptions.host}, {"port", mOptions.port}, {"rate", mOptions.rate},
+                {"duration_s", mOptions.durationSec}, {"connections", mOptions.connections},
+                {"multi_get", mOptions.multiGet}
+            }},
+            {"elapsed_s", pElapsedSec},
+            {"requests", lTotal},
+            {"throughput_rps", lThroughput},
+            {"scenarios", lScenarios}
+        };
+        cout<<lReport.dump(2)<<endl;
+        return;
+    }
+
+    cout<<fixed<<setprecision(1);
+    cout<<"target "<<(mOptions.rate > 0 ? to_string((int)mOptions.rate) + " req/s (open loop)" : string("max (closed loop)"))
+        <<", "<<mOptions.connections<<" connections, "<<pElapsedSec<<"s"<<endl;
+    cout<<"achieved "<<lThroughput<<" req/s, "<<lTotal<<" requests"<<endl<<endl;
+    cout<<left<<setw(11)<<"scenario"<<right<<setw(9)<<"count"<<setw(9)<<"ok"<<setw(8)<<"404"<<setw(8)<<"503"<<setw(8)<<"failed"
+        <<setw(12)<<"p50 ms"<<setw(12)<<"p99 ms"<<setw(12)<<"p999 ms"<<setw(14)<<"svc p99 ms"<<endl;
+    for(int s = 0; s < SCENARIO_COUNT; ++s){
+        const ScenarioStats& lStats = mStats[s];
+        if(lStats.count == 0) continue;
+        LatencyHistogram::Snapshot lResponse = lStats.responseTime.snapshot();
+        LatencyHistogram::Snapshot lService = lStats.serviceTime.snapshot();
+        cout<<left<<setw(11)<<sScenarioNames[s]<<right<<setw(9)<<lStats.count<<setw(9)<<lStats.success
+            <<setw(8)<<lStats.notFound<<setw(8)<<lStats.rejected<<setw(8)<<lStats.failed
+            <<setw(12)<<lResponse.quantileMicros(0.5) / 1000<<setw(12)<<lResponse.quantileMicros(0.99) / 1000
+            <<setw(12)<<lResponse.quantileMicros(0.999) / 1000<<setw(14)<<lService.quantileMicros(0.99) / 1000<<endl;
+    }
+    cout<<"(latency from the scheduled send time; \"svc\" = from the actual send. Percentiles are HDR bucket upper bounds, <= 12.5% error)"<<endl;
+}
+
+int main(int argc, char* argv[]){
+    try{
+        Options lOptions = parseOptions(argc, argv);
+        LoadGenerator lGenerator(lOptions);
+        lGenerator.seed();
+        double lElapsed = lGenerator.run();
+        lGenerator.report(lElapsed);
+    }
+    catch(const exception& e){
+        cerr<<"user_service_loadgen: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include "BinaryLogFormat.h"
+#include "Logger.h"
+#include "nlohmann/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Turns a binary log (--log-format binary) back into text lines or JSON lines.
+//   ./user_service_logdecode [--json] <log file>
+// Text output uses the same layout as the text logger, with microsecond timestamps.
+
+// Bounds-checked reader over the whole file
+class RecordReader{
+    const string& mData;
+    size_t mPos;
+
+    public:
+        RecordReader(const string& pData, size_t pPos) : mData(pData), mPos(pPos) {}
+
+        bool atEnd() const { return mPos >= mData.size(); }
+        size_t position() const { return mPos; }
+
+        template<typename T>
+        T read(){
+            need(sizeof(T));
+            T lValue;
+            memcpy(&lValue, mData.data() + mPos, sizeof(T));
+            mPos += sizeof(T);
+            return lValue;
+        }
+
+        string readBytes(size_t pLength){
+            need(pLength);
+            string lBytes = mData.substr(mPos, pLength);
+            mPos += pLength;
+            return lBytes;
+        }
+
+    private:
+        void need(size_t pLength){
+            if(mData.size() - mPos < pLength){
+                throw runtime_error("truncated record at offset " + to_string(mPos));
+            }
+        }
+};
+
+struct Definition {
+    string format;
+    int level;
+};
+
+static string formatTimestamp(int64_t pUnixMicros){
+    time_t lSeconds = (time_t)(pUnixMicros / 1000000);
+    tm lTm;
+    gmtime_r(&lSeconds, &lTm);
+    char lBuffer[64];
+    size_t lLength = strftime(lBuffer, sizeof(lBuffer), "%Y-%m-%dT%H:%M:%S", &lTm);
+    snprintf(lBuffer + lLength, sizeof(lBuffer) - lLength, ".%06lldZ", (long long)(pUnixMicros % 1000000));
+    return lBuffer;
+}
+
+// same substitution as formatLogTo(): "{}" placeholders in order, numbers like appendLogArg()
+static string renderMessage(const string& pFormat, const json& pArgs){
+    string lOut;
+    size_t lPos = 0;
+    for(const json& lArg : pArgs){
+        size_t lPlaceholder = pFormat.find("{}", lPos);
+        if(lPlaceholder == string::npos) break;
+        lOut.append(pFormat, lPos, lPlaceholder - lPos);
+        if(lArg.is_string()) lOut += lArg.get<string>();
+        else if(lArg.is_number_float()) appendLogArg(lOut, lArg.get<double>());
+        else lOut += lArg.dump();
+        lPos = lPlaceholder + 2;
+    }
+    lOut.append(pFormat, lPos, string::npos);
+    return lOut;
+}
+
+static void printRecord(bool pJson, int64_t pUnixMicros, int pLevel, const string& pMessage,
+                        const string* pFormat, const json* pArgs){
+    const char* lLevel = ILogger::levelName((LOG_LEVEL)pLevel);
+    if(!pJson){
+        cout<<" ["<<formatTimestamp(pUnixMicros)<<"] ["<<lLevel<<"]: "<<pMessage<<"\n";
+        return;
+    }
+    json lLine = {
+        {"timestamp", formatTimestamp(pUnixMicros)},
+        {"level", lLevel},
+        {"message", pMessage}
+    };
+    if(pFormat) lLine["format"] = *pFormat;
+    if(pArgs) lLine["args"] = *pArgs;
+    // replace: a truncated/garbled string argument must not abort the whole decode
+    cout<<lLine.dump(-1, ' ', false, json::error_handler_t::replace)<<"\n";
+}
+
+int main(int argc, char* argv[]){
+    bool lJson = false;
+    string lPath;
+    for(int i = 1; i < argc; ++i){
+        string lArg = argv[i];
+        if(lArg == "--json") lJson = true;
+        else lPath = lArg;
+    }
+    if(lPath.empty()){
+        cerr<<"Usage: ./user_service_logdecode [--json] <log file>"<<endl;
+        return 2;
+    }
+
+    ifstream lFile(lPath, ios::binary);
+    if(!lFile){
+        cerr<<"Can't open "<<lPath<<endl;
+        return 1;
+    }
+    string lData((istreambuf_iterator<char>(lFile)), istreambuf_iterator<char>());
+
+    // text written before binary mode was switched on (e.g. "Logging started.") is passed through
+    size_t lHeaderPos = lData.find(string(binlog::MAGIC, sizeof(binlog::MAGIC)));
+    if(lHeaderPos == string::npos){
+        cerr<<lPath<<" is not a binary log"<<endl;
+        return 1;
+    }
+    if(!lJson) cout<<lData.substr(0, lHeaderPos);
+
+    unordered_map<uint32_t, Definition> lDefinitions;
+    RecordReader lReader(lData, lHeaderPos + sizeof(binlog::MAGIC));
+    try{
+        uint32_t lVersion = lReader.read<uint32_t>();
+        if(lVersion != binlog::VERSION){
+            throw runtime_error("unsupported binary log version " + to_string(lVersion));
+        }
+
+        while(!lReader.atEnd()){
+            char lTag = lReader.read<char>();
+            if(lTag == binlog::RECORD_DEFINITION){
+                uint32_t lFormatId = lReader.read<uint32_t>();
+                int lLevel = lReader.read<uint8_t>();
+                uint32_t lLength = lReader.read<uint32_t>();
+                lDefinitions[lFormatId] = {lReader.readBytes(lLength), lLevel};
+            }
+            else if(lTag == binlog::RECORD_TEXT){
+                int lLevel = lReader.read<uint8_t>();
+                int64_t lMicros = lReader.read<int64_t>();
+                uint32_t lLength = lReader.read<uint32_t>();
+                printRecord(lJson, lMicros, lLevel, lReader.readBytes(lLength), nullptr, nullptr);
+            }
+            else if(lTag == binlog::RECORD_LOG){
+                uint32_t lFormatId = lReader.read<uint32_t>();
+                int64_t lMicros = lReader.read<int64_t>();
+                int lArgCount = lReader.read<uint8_t>();
+
+                json lArgs = json::array();
+                for(int i = 0; i < lArgCount; ++i){
+                    char lType = lReader.read<char>();
+                    switch(lType){
+                        case binlog::ARG_INT: lArgs.push_back(lReader.read<int64_t>()); break;
+                        case binlog::ARG_UINT: lArgs.push_back(lReader.read<uint64_t>()); break;
+                        case binlog::ARG_DOUBLE: lArgs.push_back(lReader.read<double>()); break;
+                        case binlog::ARG_STRING: lArgs.push_back(lReader.readBytes(lReader.read<uint32_t>())); break;
+                        default: throw runtime_error("unknown argument type at offset " + to_string(lReader.position()));
+                    }
+                }
+
+                auto lIt = lDefinitions.find(lFormatId);
+                if(lIt == lDefinitions.end()){
+                    throw runtime_error("record uses undefined format id " + to_string(lFormatId));
+                }
+                printRecord(lJson, lMicros, lIt->second.level, renderMessage(lIt->second.format, lArgs),
+                            &lIt->second.format, &lArgs);
+            }
+            else{
+                throw runtime_error("unknown record tag at offset " + to_string(lReader.position() - 1));
+            }
+        }
+    }
+    catch(const exception& e){
+        // a log cut short by a crash still decodes up to the last complete record
+        cout.flush();
+        cerr<<"user_service_logdecode: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using namespace std;
+using json = nlohmann::json;
+
+// Performance regression gate - compares benchmark results against a checked-in baseline.
+//
+//   ./user_service_perfcheck --baseline perf/baseline.json [--bench bench.json]...
+//                            [--handler handler.json]... [--load loadgen.json] [--update]
+//
+// The inputs are the --json outputs of user_service_bench, user_service_handler_bench and
+// user_service_loadgen; scripts/perf-check.sh (cmake --build . --target perf-check) runs them.
+// Every number becomes a metric, e.g. "handler/get_user:allocs_per_request", and the baseline
+// keeps one entry per metric:
+//   "handler/get_user:allocs_per_request": {"value": 74, "tolerance": 0.05, "better": "lower"}
+// A metric regresses when it is more than `tolerance` (a fraction) worse than `value`.
+// --bench/--handler can be given several times (repeated runs): each metric then uses its best
+// value, which filters out most of the noise of a shared machine - a real regression makes
+// every run slower.
+// Tolerances are per metric: allocation counts are exact and get a tight one, tail latencies
+// on a shared machine a loose one. Edit them in the baseline file; --update rewrites the values
+// from the current run and keeps the tolerances that are already there.
+//
+// A baseline metric the run didn't produce (renamed or dropped scenario) fails the check too -
+// remove it from the baseline (or --update) when that is intended.
+// The handler benchmark's thread count is recorded in the baseline ("handler_threads"); a run
+// with a different count is refused, its req/s and tail latencies measure the core count.
+//
+// Exit code: 0 = no regression, 1 = at least one metric regressed or missing, 2 = usage/input error.
+
+struct Metric {
+    double value = 0;
+    double tolerance = 0;
+    bool lowerIsBetter = true;
+};
+
+// default tolerance and direction for a new metric, by what it measures
+static Metric defaultsFor(const string& pName, double pValue){
+    Metric lMetric;
+    lMetric.value = pValue;
+    string lKind = pName.substr(pName.rfind(':') + 1);
+    bool lThroughput = lKind == "requests_per_sec" || lKind == "ops_per_sec" || lKind == "throughput_rps";
+    lMetric.lowerIsBetter = !lThroughput;
+    if(lKind == "allocs_per_request" || lKind == "bytes_per_request") lMetric.tolerance = 0.05;
+    else if(lKind == "throughput_rps") lMetric.tolerance = 0.05; // open loop: should always reach the rate
+    else if(lKind == "ns_per_op" || lKind == "cpu_us_per_request" || lThroughput) lMetric.tolerance = 0.40;
+    else if(lKind == "p99_us" || lKind == "p999_us") lMetric.tolerance = 1.0;
+    else lMetric.tolerance = 0.5; // p50
+    return lMetric;
+}
+
+// keeps the best value seen for a metric
+static void mergeBest(map<string, double>& pCurrent, const string& pName, double pValue){
+    auto lIt = pCurrent.find(pName);
+    if(lIt == pCurrent.end()){
+        pCurrent[pName] = pValue;
+        return;
+    }
+    bool lLowerIsBetter = defaultsFor(pName, pValue).lowerIsBetter;
+    lIt->second = lLowerIsBetter ? min(lIt->second, pValue) : max(lIt->second, pValue);
+}
+
+static json readJson(const string& pPath){
+    ifstream lIn(pPath);
+    if(!lIn) throw runtime_error("Cannot open " + pPath);
+    try{
+        return json::parse(lIn);
+    }
+    catch(const json::exception& e){
+        throw runtime_error(pPath + ": " + e.what());
+    }
+}
+
+// user_service_bench --json
+static void collectBench(const json& pReport, map<string, double>& pCurrent){
+    for(const json& lCase : pReport.at("benchmarks")){
+        string lName = "bench/" + lCase.at("name").get<string>();
+        mergeBest(pCurrent, lName + ":ns_per_op", lCase.at("ns_per_op"));
+        if(lCase.contains("counters") && lCase["counters"].contains("ops_per_sec")){
+            mergeBest(pCurrent, lName + ":ops_per_sec", lCase["counters"]["ops_per_sec"]);
+        }
+    }
+}
+
+// user_service_handler_bench --json
+static void collectHandler(const json& pReport, map<string, double>& pCurrent){
+    for(const json& lCase : pReport.at("benchmarks")){
+        string lName = lCase.at("name").get<string>(); // already "handler/..."
+        for(const char* lKey : {"requests_per_sec", "cpu_us_per_request", "allocs_per_request", "bytes_per_request", "p99_us"}){
+            mergeBest(pCurrent, lName + ":" + lKey, lCase.at(lKey));
+        }
+    }
+}
+
+// user_service_loadgen --json
+static void collectLoad(const json& pReport, map<string, double>& pCurrent){
+    pCurrent["loadgen:throughput_rps"] = pReport.at("throughput_rps");
+    for(auto& lScenario : pReport.at("scenarios").items()){
+        const json& lResponse = lScenario.value().at("response_time");
+        pCurrent["loadgen/" + lScenario.key() + ":p50_us"] = lResponse.at("p50_us");
+        pCurrent["loadgen/" + lScenario.key() + ":p99_us"] = lResponse.at("p99_us");
+    }
+}
+
+static string formatValue(double pValue){
+    ostringstream lOut;
+    if(fabs(pValue) >= 100) lOut<<fixed<<setprecision(0)<<pValue;
+    else lOut<<fixed<<setprecision(2)<<pValue;
+    return lOut.str();
+}
+
+int main(int argc, char* argv[]){
+    string lBaselinePath;
+    vector<pair<string, string>> lInputs; // kind, path
+    bool lUpdate = false;
+    try{
+        for(int i = 1; i < argc; ++i){
+            string lArg = argv[i];
+            if(lArg == "--update"){ lUpdate = true; continue; }
+            if(i + 1 >= argc) throw invalid_argument("Missing value for option " + lArg);
+            string lValue = argv[++i];
+            if(lArg == "--baseline") lBaselinePath = lValue;
+            else if(lArg == "--bench" || lArg == "--handler" || lArg == "--load") lInputs.emplace_back(lArg.substr(2), lValue);
+            else throw invalid_argument("Unknown option " + lArg);
+        }
+        if(lBaselinePath.empty() || lInputs.empty()){
+            throw invalid_argument("Usage: ./user_service_perfcheck --baseline <file> [--bench f] [--handler f] [--load f] [--update]");
+        }
+
+        map<string, double> lCurrent;
+        string lBuildType;
+        int lHardwareThreads = 0;
+        int lHandlerThreads = 0;
+        for(auto& [lKind, lPath] : lInputs){
+            json lReport = readJson(lPath);
+            if(lReport.contains("context") && lReport["context"].contains("build_type")){
+                lBuildType = lReport["context"]["build_type"];
+                lHardwareThreads = lReport["context"].value("hardware_threads", 0);
+            }
+            if(lKind == "handler" && lReport.contains("context")){
+                int lThreads = lReport["context"].value("threads", 0);
+                if(lHandlerThreads != 0 && lThreads != lHandlerThreads){
+                    throw runtime_error("handler reports were run with different --threads");
+                }
+                lHandlerThreads = lThreads;
+            }
+            if(lKind == "bench") collectBench(lReport, lCurrent);
+            else if(lKind == "handler") collectHandler(lReport, lCurrent);
+            else collectLoad(lReport, lCurrent);
+        }
+
+        map<string, Metric> lBaseline;
+        json lBaselineJson = json::object();
+        {
+            ifstream lIn(lBaselinePath);
+            if(lIn) lBaselineJson = readJson(lBaselinePath);
+            else if(!lUpdate) throw runtime_error("No baseline at " + lBaselinePath + " - create one with --update");
+        }
+        if(lBaselineJson.contains("metrics")){
+            for(auto& lEntry : lBaselineJson["metrics"].items()){
+                Metric lMetric;
+                lMetric.value = lEntry.value().at("value");
+                lMetric.tolerance = lEntry.value().value("tolerance", 0.0);
+                lMetric.lowerIsBetter = lEntry.value().value("better", string("lower")) == "lower";
+                lBaseline[lEntry.key()] = lMetric;
+            }
+        }
+        json lBaselineContext = lBaselineJson.value("context", json::object());
+        string lBaselineBuildType = lBaselineContext.value("build_type", string());
+        int lBaselineHardwareThreads = lBaselineContext.value("hardware_threads", 0);
+        int lBaselineHandlerThreads = lBaselineContext.value("handler_threads", 0);
+
+        if(lUpdate){
+            json lMetrics = json::object();
+            for(auto& [lName, lValue] : lCurrent){
+                auto lExisting = lBaseline.find(lName);
+                Metric lMetric = (lExisting != lBaseline.end()) ? lExisting->second : defaultsFor(lName, lValue);
+                lMetrics[lName] = {
+                    {"value", lValue},
+                    {"tolerance", lMetric.tolerance},
+                    {"better", lMetric.lowerIsBetter ? "lower" : "higher"}
+                };
+            }
+            json lOut = {
+                {"context", {{"build_type", lBuildType}, {"hardware_threads", lHardwareThreads},
+                             {"handler_threads", lHandlerThreads}, {"updated", (int64_t)time(nullptr)}}},
+                {"metrics", lMetrics}
+            };
+            ofstream(lBaselinePath)<<lOut.dump(2)<<endl;
+            cout<<"baseline written: "<<lBaselinePath<<" ("<<lMetrics.size()<<" metrics)"<<endl;
+            return 0;
+        }
+
+        if(lBaselineHandlerThreads != 0 && lHandlerThreads != 0 && lBaselineHandlerThreads != lHandlerThreads){
+            throw runtime_error("handler benchmark ran with --threads " + to_string(lHandlerThreads) + ", the baseline with " +
+                                to_string(lBaselineHandlerThreads) + " - numbers are not comparable");
+        }
+        if(!lBaselineBuildType.empty() && lBaselineBuildType != lBuildType){
+            cout<<"warning: baseline is from a "<<lBaselineBuildType<<" build, this run is "<<lBuildType<<" - numbers are not comparable"<<endl;
+        }
+        if(lBaselineHardwareThreads != 0 && lBaselineHardwareThreads != lHardwareThreads){
+            cout<<"warning: baseline was recorded with "<<lBaselineHardwareThreads<<" hardware threads, this machine has "
+                <<lHardwareThreads<<" - refresh it with the perf-baseline target"<<endl;
+        }
+
+        int lRegressions = 0, lImprovements = 0, lMissing = 0;
+        size_t lNameWidth = 8;
+        for(auto& lEntry : lBaseline) lNameWidth = max(lNameWidth, lEntry.first.size() + 2);
+        for(auto& lEntry : lCurrent) lNameWidth = max(lNameWidth, lEntry.first.size() + 2);
+        cout<<left<<setw(lNameWidth)<<"metric"<<right<<setw(13)<<"baseline"<<setw(13)<<"current"<<setw(10)<<"change"<<setw(9)<<"limit"<<"  status"<<endl;
+        for(auto& [lName, lMetric] : lBaseline){
+            auto lIt = lCurrent.find(lName);
+            if(lIt == lCurrent.end()){
+                cout<<left<<setw(lNameWidth)<<lName<<right<<setw(13)<<formatValue(lMetric.value)<<setw(13)<<"-"<<setw(10)<<""<<setw(9)<<""<<"  MISSING"<<endl;
+                ++lMissing;
+                continue;
+            }
+            double lValue = lIt->second;
+            // positive = worse, whichever direction is better for this metric
+            double lChange = (lMetric.value != 0) ? (lValue - lMetric.value) / fabs(lMetric.value) : 0;
+            double lWorse = lMetric.lowerIsBetter ? lChange : -lChange;
+            const char* lStatus = "ok";
+            if(lWorse > lMetric.tolerance){ lStatus = "REGRESSED"; ++lRegressions; }
+            else if(lWorse < -lMetric.tolerance){ lStatus = "improved"; ++lImprovements; }
+
+            ostringstream lChangeText, lLimitText;
+            lChangeText<<showpos<<fixed<<setprecision(1)<<lChange * 100<<"%";
+            lLimitText<<(lMetric.lowerIsBetter ? "+" : "-")<<fixed<<setprecision(0)<<lMetric.tolerance * 100<<"%";
+            cout<<left<<setw(lNameWidth)<<lName<<right<<setw(13)<<formatValue(lMetric.value)<<setw(13)<<formatValue(lValue)
+                <<setw(10)<<lChangeText.str()<<setw(9)<<lLimitText.str()<<"  "<<lStatus<<endl;
+        }
+        for(auto& [lName, lValue] : lCurrent){
+            if(lBaseline.count(lName)) continue;
+            cout<<left<<setw(lNameWidth)<<lName<<right<<setw(13)<<"-"<<setw(13)<<formatValue(lValue)<<setw(10)<<""<<setw(9)<<""<<"  new (not in baseline)"<<endl;
+        }
+
+        cout<<endl<<lRegressions<<" regressed, "<<lMissing<<" missing, "<<lImprovements<<" improved beyond tolerance, "
+            <<lBaseline.size()<<" metrics in baseline"<<endl;
+        if(lMissing > 0){
+            cout<<"(missing: the run didn't produce these - drop them from the baseline if the scenario is gone)"<<endl;
+        }
+        if(lRegressions > 0 || lMissing > 0){
+            cout<<"PERF CHECK FAILED"<<endl;
+            return 1;
+        }
+        cout<<"perf check passed"<<endl;
+    }
+    catch(const exception& e){
+        cerr<<"user_service_perfcheck: "<<e.what()<<endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>   // getpid
+#include <httplib.h>
+#include <sqlite3.h>
+#include <nlohmann/json.hpp>
+#include "Logger.h"
+#include "Metrics.h"
+#include "RequestCapture.h"
+#include "UserService.h"
+
+using namespace std;
+using json = nlohmann::json;
+using Clock = chrono::steady_clock;
+
+// Replays requests recorded with "user_service --capture <file>".
+//
+//   ./user_service_replay <capture.jsonl>... [--mode inprocess|http] [--speed original|max|<factor>]
+//                         [--connections 8] [--host localhost] [--port 8001] [--db <path>]
+//                         [--unique-emails on|off] [--json]
+//
+// --mode inprocess (default) runs the requests through UserService::dispatch on a fresh database
+//   - no sockets, so the numbers are the service's own cost. --db <path> starts from a copy of a
+//   real one instead (SQLite online backup, so a live server's file is fine); the file itself
+//   is never written.
+// --mode http sends them to a running server over --connections keep-alive connections.
+// --speed original keeps the captured inter-arrival times, 2 plays them twice as fast, max sends
+//   back to back. With a timed speed the replay is open loop, like user_service_loadgen: latency
+//   is measured from the time a request was due, so stalls are not hidden.
+// Several capture files (one per --workers process) are merged by timestamp.
+// Redacted passwords are sent as "<redacted>" - any password hashes the same. Emails and
+// usernames are the capture's pseudonyms, so lookups of real users in a --db copy miss. Signups of emails
+// that already exist fail with 400; --unique-emails on (default for http) adds a per-run tag.
+// Prefix and substring lookups (username_prefix, /users/suggest, /users/search) can't be
+// reproduced from pseudonyms at all: they replay as empty results with the captured status.
+// The report marks routes with such requests ("*", "not_replay_faithful" in --json).
+
+struct Options {
+    vector<string> captures;
+    bool inProcess = true;
+    double speed = 1;             // 0 = max
+    int connections = 8;
+    string host = "localhost";
+    int port = 8001;
+    string dbPath;                // copied before the run; empty: a fresh database
+    int uniqueEmails = -1;        // -1: on for http, off in-process
+    bool json = false;
+};
+
+// "GET /users/{id}" - numeric path segments folded, query string dropped
+static string groupFor(const RequestCapture::Entry& pEntry){
+    string lPath = pEntry.target.substr(0, pEntry.target.find('?'));
+    string lGroup = pEntry.method + " ";
+    size_t lPos = 0;
+    while(lPos < lPath.size()){
+        size_t lEnd = lPath.find('/', lPos + 1);
+        if(lEnd == string::npos) lEnd = lPath.size();
+        string lSegment = lPath.substr(lPos, lEnd - lPos); // "/123"
+        bool lNumeric = lSegment.size() > 1 && all_of(lSegment.begin() + 1, lSegment.end(), ::isdigit);
+        lGroup += lNumeric ? "/{id}" : lSegment;
+        lPos = lEnd;
+    }
+    return lGroup;
+}
+
+struct GroupStats {
+    LatencyHistogram responseTime; // from the due time
+    LatencyHistogram serviceTime;  // from the moment the request was actually sent/dispatched
+    LatencyHistogram capturedTime; // what the service took when the request was captured
+    atomic<uint64_t> count{0};
+    atomic<uint64_t> byStatusClass[5] = {};
+    atomic<uint64_t> failed{0};     // transport errors
+    atomic<uint64_t> mismatched{0}; // status differs from the captured one
+    uint64_t notFaithful = 0;       // requests that can't find what they found at capture time
+};
+
+static Options parseOptions(int argc, char* argv[]){
+    Options lOptions;
+    for(int i = 1; i < argc; ++i){
+        string lArg = argv[i];
+        if(lArg == "--json"){ lOptions.json = true; continue; }
+        if(lArg.rfind("--", 0) != 0){ lOptions.captures.push_back(lArg); continue; }
+        if(i + 1 >= argc) throw invalid_argument("Missing value for option " + lArg);
+        string lValue = argv[++i];
+        if(lArg == "--mode"){
+            if(lValue != "inprocess" && lValue != "http") throw invalid_argument("--mode must be inprocess or http");
+            lOptions.inProcess = lValue == "inprocess";
+        }
+        else if(lArg == "--speed"){
+            if(lValue == "original") lOptions.speed = 1;
+            else if(lValue == "max") lOptions.speed = 0;
+            else{
+                lOptions.speed = stod(lValue);
+                if(lOptions.speed <= 0) throw invalid_argument("--speed must be original, max or a factor > 0");
+            }
+        }
+        else if(lArg == "--connections") lOptions.connections = max(1, stoi(lValue));
+        else if(lArg == "--host") lOptions.host = lValue;
+        else if(lArg == "--port") lOptions.port = stoi(lValue);
+        else if(lArg == "--db") lOptions.dbPath = lValue;
+        else if(lArg == "--unique-emails") lOptions.uniqueEmails = lValue != "off";
+        else throw invalid_argument("Unknown option " + lArg);
+    }
+    if(lOptions.captures.empty()){
+        throw invalid_argument("Usage: ./user_service_replay <capture.jsonl>... [--mode inprocess|http] [--speed original|max|<factor>] [--connections N] [--host H] [--port P] [--db <path>] [--unique-emails on|off] [--json]");
+    }
+    if(lOptions.uniqueEmails < 0) lOptions.uniqueEmails = lOptions.inProcess ? 0 : 1;
+    return lOptions;
+}
+
+// Copies pFrom with SQLite's online backup: a consistent snapshot even while a server writes to
+// it (a plain file copy could catch it mid-transaction and miss the -wal file)
+static void copyDatabase(const string& pFrom, const string& pTo){
+    sqlite3* lFrom = nullptr;
+    sqlite3* lTo = nullptr;
+    int rc = sqlite3_open_v2(pFrom.c_str(), &lFrom, SQLITE_OPEN_READONLY, nullptr);
+    if(rc == SQLITE_OK) rc = sqlite3_open(pTo.c_str(), &lTo);
+    if(rc == SQLITE_OK){
+        sqlite3_backup* lBackup = sqlite3_backup_init(lTo, "main", lFrom, "main");
+        if(lBackup){
+            rc = sqlite3_backup_step(lBackup, -1);
+            sqlite3_backup_finish(lBackup);
+            if(rc == SQLITE_DONE) rc = SQLITE_OK;
+        }
+        else{
+            rc = sqlite3_errcode(lTo);
+        }
+    }
+    string lError = (rc == SQLITE_OK) ? "" : string(sqlite3_errstr(rc));
+    sqlite3_close(lFrom);
+    sqlite3_close(lTo);
+    if(!lError.empty()){
+        throw runtime_error("Cannot copy " + pFrom + ": " + lError);
+    }
+}
+
+class Replayer{
+    Options mOptions;
+    vector<RequestCapture::Entry> mEntries;
+    vector<GroupStats*> mEntryGroup;                   // per entry, resolved before the run
+    map<string, unique_ptr<GroupStats>> mGroups;
+    vector<string> mBodies;                            // per entry, encoded before the run
+    unique_ptr<UserService> mService;                  // in-process mode
+    string mTempDbPath, mTempLogPath;
+    atomic<uint64_t> mNext{0};
+
+    public:
+        explicit Replayer(const Options& pOptions) : mOptions(pOptions){
+            for(const string& lPath : mOptions.captures){
+                vector<RequestCapture::Entry> lEntries = RequestCapture::load(lPath);
+                mEntries.insert(mEntries.end(), make_move_iterator(lEntries.begin()), make_move_iterator(lEntries.end()));
+            }
+            stable_sort(mEntries.begin(), mEntries.end(), [](const RequestCapture::Entry& a, const RequestCapture::Entry& b){
+                return a.tsMicros < b.tsMicros;
+            });
+            if(mEntries.empty()) throw runtime_error("no requests in the capture");
+
+            string lRunTag = "r" + to_string(getpid()) + "_" + to_string(time(nullptr)); // the email check allows [a-zA-Z0-9._] only
+            for(RequestCapture::Entry& lEntry : mEntries){
+                unique_ptr<GroupStats>& lGroup = mGroups[groupFor(lEntry)];
+                if(!lGroup) lGroup = make_unique<GroupStats>();
+                mEntryGroup.push_back(lGroup.get());
+                if(lEntry.latencyMicros > 0) lGroup->capturedTime.record((uint64_t)lEntry.latencyMicros);
+                if(!RequestCapture::replayFaithful(lEntry.target)) ++lGroup->notFaithful;
+
+                if(mOptions.uniqueEmails && lEntry.body.is_object() && lEntry.body.contains("email") && lEntry.body["email"].is_string()){
+                    string lEmail = lEntry.body["email"];
+                    size_t lAt = lEmail.find('@');
+                    lEntry.body["email"] = (lAt == string::npos) ? lEmail + "." + lRunTag
+                                                                  : lEmail.substr(0, lAt) + "." + lRunTag + lEmail.substr(lAt);
+                }
+                mBodies.push_back(RequestCapture::encodeBody(lEntry));
+            }
+
+            if(mOptions.inProcess){
+                string lPid = to_string(getpid());
+                mTempDbPath = "/tmp/user_service_replay_" + lPid + ".db";
+                if(!mOptions.dbPath.empty()) copyDatabase(mOptions.dbPath, mTempDbPath);
+                mTempLogPath = "/tmp/user_service_replay_" + lPid + ".log";
+                FileLogger::getInstance(mTempLogPath)->setLogLevel(LOG_LEVEL::ERROR); // the server's default
+                mService = make_unique<UserService>(mTempDbPath, mTempLogPath);
+            }
+        }
+
+        ~Replayer(){
+            mService.reset();
+            if(!mTempDbPath.empty()){
+                for(const char* lSuffix : {"", "-wal", "-shm"}) remove((mTempDbPath + lSuffix).c_str());
+            }
+            if(!mTempLogPath.empty()) remove(mTempLogPath.c_str());
+        }
+
+        double run(){
+            vector<thread> lThreads;
+            Clock::time_point lStart = Clock::now() + chrono::milliseconds(50); // let every thread get ready
+            for(int c = 0; c < mOptions.connections; ++c){
+                lThreads.emplace_back(&Replayer::workerLoop, this, lStart);
+            }
+            for(thread& lThread : lThreads) lThread.join();
+            return chrono::duration<double>(Clock::now() - lStart).count();
+        }
+
+        void report(double pElapsedSec) const;
+
+    private:
+        void workerLoop(Clock::time_point pStart){
+            unique_ptr<httplib::Client> lClient;
+            if(!mOptions.inProcess){
+                lClient = make_unique<httplib::Client>(mOptions.host, mOptions.port);
+                lClient->set_keep_alive(true);
+                lClient->set_tcp_nodelay(true);
+            }
+            int64_t lFirstTs = mEntries.front().tsMicros;
+
+            this_thread::sleep_until(pStart);
+            for(;;){
+                uint64_t lIndex = mNext.fetch_add(1, memory_order_relaxed);
+                if(lIndex >= mEntries.size()) break;
+                const RequestCapture::Entry& lEntry = mEntries[lIndex];
+
+                Clock::time_point lDue;
+                if(mOptions.speed > 0){
+                    double lOffsetSec = (lEntry.tsMicros - lFirstTs) / 1e6 / mOptions.speed;
+                    lDue = pStart + chrono::duration_cast<Clock::duration>(chrono::duration<double>(lOffsetSec));
+                    this_thread::sleep_until(lDue); // returns at once when we're already behind
+                }
+                else{
+                    lDue = Clock::now();
+                }
+
+                Clock::time_point lSent = Clock::now();
+                int lStatus = lClient ? sendHttp(*lClient, lEntry, mBodies[lIndex]) : sendInProcess(lEntry, mBodies[lIndex]);
+                Clock::time_point lDone = Clock::now();
+
+                GroupStats& lStats = *mEntryGroup[lIndex];
+                lStats.responseTime.recordDuration(lDone - lDue);
+                lStats.serviceTime.recordDuration(lDone - lSent);
+                lStats.count.fetch_add(1, memory_order_relaxed);
+                int lStatusClass = lStatus / 100 - 1;
+                if(lStatusClass >= 0 && lStatusClass < 5) lStats.byStatusClass[lStatusClass].fetch_add(1, memory_order_relaxed);
+                else lStats.failed.fetch_add(1, memory_order_relaxed);
+                if(lEntry.status != 0 && lStatus != lEntry.status) lStats.mismatched.fetch_add(1, memory_order_relaxed);
+            }
+        }
+
+        int sendInProcess(const RequestCapture::Entry& pEntry, const string& pBody){
+            httplib::Request lReq;
+            lReq.method = pEntry.method;
+            lReq.target = pEntry.target;
+            lReq.headers = pEntry.headers;
+            lReq.body = pBody;
+            httplib::Response lRes;
+            mService->dispatch(lReq, lRes);
+            return lRes.status;
+        }
+
+        // returns the HTTP status, 0 on a transport error
+        static int sendHttp(httplib::Client& pClient, const RequestCapture::Entry& pEntry, const string& pBody){
+            httplib::Request lReq;
+            lReq.method = pEntry.method;
+            lReq.path = pEntry.target;
+            lReq.headers = pEntry.headers;
+            lReq.body = pBody;
+            httplib::Result lResult = pClient.send(lReq);
+            return lResult ? lResult->status : 0;
+        }
+};
+
+static json histogramJson(const LatencyHistogram::Snapshot& pSnapshot){
+    return {
+        {"p50_us", pSnapshot.quantileMicros(0.5)},
+        {"p90_us", pSnapshot.quantileMicros(0.9)},
+        {"p99_us", pSnapshot.quantileMicros(0.99)},
+        {"p999_us", pSnapshot.quantileMicros(0.999)},
+        {"mean_us", pSnapshot.count ? (double)pSnapshot.sumMicros / pSnapshot.count : 0.0}
+    };
+}
+
+void Replayer::report(double pElapsedSec) const{
+    uint64_t lTotal = 0;
+    double lCapturedSpanSec = (mEntries.back().tsMicros - mEntries.front().tsMicros) / 1e6;
+    char lFactor[32];
+    snprintf(lFactor, sizeof(lFactor), "%gx", mOptions.speed);
+    string lSpeed = mOptions.speed > 0 ? lFactor : "max";
+    const char* lStatusClasses[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+    json lGroups = json::object();
+    for(const auto& [lName, lStats] : mGroups){
+        if(lStats->count == 0) continue;
+        lTotal += lStats->count;
+        json lStatuses = json::object();
+        for(int i = 0; i < 5; ++i){
+            if(lStats->byStatusClass[i]) lStatuses[lStatusClasses[i]] = lStats->byStatusClass[i].load();
+        }
+        lGroups[lName] = {
+            {"count", lStats->count.load()},
+            {"status", lStatuses},
+            {"failed", lStats->failed.load()},
+            {"status_mismatch", lStats->mismatched.load()},
+            {"not_replay_faithful", lStats->notFaithful},
+            {"response_time", histogramJson(lStats->responseTime.snapshot())},
+            {"service_time", histogramJson(lStats->serviceTime.snapshot())},
+            {"captured_time", histogramJson(lStats->capturedTime.snapshot())}
+        };
+    }
+    double lThroughput = lTotal / pElapsedSec;
+
+    if(mOptions.json){
+        json lReport = {
+            {"config", {
+                {"mode", mOptions.inProcess ? "inprocess" : "http"}, {"speed", lSpeed},
+                {"connections", mOptions.connections}, {"captures", mOptions.captures}
+            }},
+            {"captured_span_s", lCapturedSpanSec},
+            {"elapsed_s", pElapsedSec},
+            {"requests", lTotal},
+            {"throughput_rps", lThroughput},
+            {"routes", lGroups}
+        };
+        cout<<lReport.dump(2)<<endl;
+        return;
+    }
+
+    cout<<fixed<<setprecision(1);
+    cout<<"replayed "<<lTotal<<" requests ("<<lCapturedSpanSec<<"s captured) "
+        <<(mOptions.inProcess ? "in-process" : "over http")<<" at "<<lSpeed<<" speed, "
+        <<mOptions.connections<<(mOptions.inProcess ? " threads" : " connections")<<endl;
+    cout<<"took "<<pElapsedSec<<"s, "<<lThroughput<<" req/s"<<endl<<endl;
+    cout<<left<<setw(22)<<"route"<<right<<setw(8)<<"count"<<setw(7)<<"2xx"<<setw(7)<<"3xx"<<setw(7)<<"4xx"<<setw(7)<<"5xx"
+        <<setw(9)<<"differ"<<setw(11)<<"p50 ms"<<setw(11)<<"p99 ms"<<setw(11)<<"p999 ms"<<setw(13)<<"svc p99 ms"<<setw(13)<<"capt p99 ms"<<endl;
+    bool lAnyNotFaithful = false;
+    for(const auto& [lName, lStats] : mGroups){
+        if(lStats->count == 0) continue;
+        lAnyNotFaithful |= lStats->notFaithful > 0;
+        LatencyHistogram::Snapshot lResponse = lStats->responseTime.snapshot();
+        LatencyHistogram::Snapshot lService = lStats->serviceTime.snapshot();
+        LatencyHistogram::Snapshot lCaptured = lStats->capturedTime.snapshot();
+        cout<<left<<setw(22)<<(lStats->notFaithful ? lName + " *" : lName)<<right<<setw(8)<<lStats->count<<setw(7)<<lStats->byStatusClass[1]
+            <<setw(7)<<lStats->byStatusClass[2]<<setw(7)<<lStats->byStatusClass[3]<<setw(7)<<lStats->byStatusClass[4]
+            <<setw(9)<<lStats->mismatched
+            <<setw(11)<<lResponse.quantileMicros(0.5) / 1000<<setw(11)<<lResponse.quantileMicros(0.99) / 1000
+            <<setw(11)<<lResponse.quantileMicros(0.999) / 1000<<setw(13)<<lService.quantileMicros(0.99) / 1000
+            <<setw(13)<<lCaptured.quantileMicros(0.99) / 1000<<endl;
+    }
+    cout<<"(\"differ\" = status not the captured one, \"capt\" = latency at capture time. Percentiles are HDR bucket upper bounds, <= 12.5% error)"<<endl;
+    if(lAnyNotFaithful){
+        cout<<"* has prefix/substring lookups (username_prefix, suggest/search q) of pseudonyms: they match nothing on replay,"<<endl
+            <<"  same status but the empty-result path - not the captured work"<<endl;
+    }
+}
+
+int main(int argc, char* argv[]){
+    try{
+        Options lOptions = parseOptions(argc, argv);
+        Replayer lReplayer(lOptions);
+        double lElapsed = lReplayer.run();
+        lReplayer.report(lElapsed);
+    }
+    catch(const exception& e){
+        cerr<<"user_service_replay: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}